@@ -13,12 +13,32 @@
 
 int numberThreads = 0;
 
-char inputCommands[MAX_COMMANDS][MAX_INPUT_SIZE];
+/*
+ * Command already parsed by processInput, so threads apply it straight away. Paths are offsets
+ * in pathArena, where each distinct path is kept once
+ */
+typedef struct command {
+    char token;  /* 'c', 'l' or 'd' */
+    type nodeType;  /* type of the node to create */
+    int name;
+} command;
+
+/* grows as commands are read, up to MAX_COMMANDS */
+command *inputCommands = NULL;
+int commandsSize = 0;
 
 int numberCommands = 0;
 
 int headQueue = 0;
 
+/* interned paths, each one followed by its '\0' */
+char *pathArena = NULL;
+int pathArenaSize = 0, pathArenaUsed = 0;
+
+/* open addressing table of the paths in pathArena (offsets, -1 if the bucket is empty) */
+int *pathTable = NULL;
+int pathTableSize = 0, numberPaths = 0;
+
 /* file paths */
 char *input_file_path;
 char *output_file_path;
@@ -31,19 +51,100 @@ pthread_rwlock_t rw_lock = PTHREAD_RWLOCK_INITIALIZER;
 pthread_mutex_t mtx_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
-int insertCommand(char* data) {
-    if(numberCommands != MAX_COMMANDS) {
-        strcpy(inputCommands[numberCommands++], data);
-        return 1;
+/* hashes a path (djb2) */
+unsigned int hashPath(char *path) {
+    unsigned int hash = 5381;
+    while (*path != '\0')
+        hash = hash * 33 + (unsigned char) *path++;
+    return hash;
+}
+
+
+/*
+ * Returns: the path at an offset of pathArena
+ */
+char* pathAt(int offset) {
+    return pathArena + offset;
+}
+
+
+/* puts an offset in its bucket of pathTable, which must have room for it */
+void placePath(int offset) {
+    unsigned int bucket = hashPath(pathAt(offset)) & (pathTableSize - 1);
+    while (pathTable[bucket] != -1)
+        bucket = (bucket + 1) & (pathTableSize - 1);
+    pathTable[bucket] = offset;
+}
+
+
+/*
+ * Keeps a path in pathArena, unless it is already there.
+ * Input:
+ *  - path: path read from the input file
+ * Returns:
+ *  offset of the path in pathArena
+ */
+int internPath(char *path) {
+
+    /* the table is doubled when half full, so buckets are found after a few probes */
+    if (2 * (numberPaths + 1) > pathTableSize) {
+        int *oldTable = pathTable, oldSize = pathTableSize;
+
+        pathTableSize = oldSize > 0 ? 2 * oldSize : 1024;
+        pathTable = malloc(pathTableSize * sizeof(int));
+        assert__(pathTable != NULL, "Error: out of memory for paths.\n")
+        memset(pathTable, -1, pathTableSize * sizeof(int));
+
+        for (int i = 0; i < oldSize; i++)
+            if (oldTable[i] != -1) placePath(oldTable[i]);
+        free(oldTable);
     }
-    return 0;
+
+    unsigned int bucket = hashPath(path) & (pathTableSize - 1);
+    while (pathTable[bucket] != -1) {
+        if (strcmp(pathAt(pathTable[bucket]), path) == 0)
+            return pathTable[bucket];
+        bucket = (bucket + 1) & (pathTableSize - 1);
+    }
+
+    int length = strlen(path) + 1;
+    while (pathArenaUsed + length > pathArenaSize) {
+        pathArenaSize = pathArenaSize > 0 ? 2 * pathArenaSize : 64 * 1024;
+        pathArena = realloc(pathArena, pathArenaSize);
+        assert__(pathArena != NULL, "Error: out of memory for paths.\n")
+    }
+
+    int offset = pathArenaUsed;
+    memcpy(pathArena + offset, path, length);
+    pathArenaUsed += length;
+
+    pathTable[bucket] = offset;
+    numberPaths++;
+    return offset;
+}
+
+
+int insertCommand(command* data) {
+    if(numberCommands == MAX_COMMANDS)
+        return 0;
+
+    if(numberCommands == commandsSize) {
+        commandsSize = commandsSize > 0 ? 2 * commandsSize : 1024;
+        if(commandsSize > MAX_COMMANDS)
+            commandsSize = MAX_COMMANDS;
+        inputCommands = realloc(inputCommands, commandsSize * sizeof(command));
+        assert__(inputCommands != NULL, "Error: out of memory for commands.\n")
+    }
+
+    inputCommands[numberCommands++] = *data;
+    return 1;
 }
 
 
-char* removeCommand() {
+command* removeCommand() {
     if(numberCommands > 0){
         numberCommands--;
-        return inputCommands[headQueue++];  
+        return &inputCommands[headQueue++];
     }
     return NULL;
 }
@@ -55,6 +156,9 @@ void errorParse(){
 }
 
 
+/*
+ * Reads the input file, turning each line into a command. Lines are only parsed here
+ */
 void processInput(){
     char line[MAX_INPUT_SIZE];
 
@@ -64,10 +168,11 @@ void processInput(){
 
     /* break loop with ^Z or ^D */
     while (fgets(line, sizeof(line)/sizeof(char), file)) {
-        char token, type;
+        char token, nodeType;
         char name[MAX_INPUT_SIZE];
+        command current;
 
-        int numTokens = sscanf(line, "%c %s %c", &token, name, &type);
+        int numTokens = sscanf(line, "%c %s %c", &token, name, &nodeType);
 
         /* perform minimal validation */
         if (numTokens < 1) {
@@ -77,27 +182,38 @@ void processInput(){
             case 'c':
                 if(numTokens != 3)
                     errorParse();
-                if(insertCommand(line))
+                switch (nodeType) {
+                    case 'f':
+                        current.nodeType = T_FILE;
+                        break;
+                    case 'd':
+                        current.nodeType = T_DIRECTORY;
+                        break;
+                    default:
+                        fprintf(stderr, "Error: invalid node type\n");
+                        exit(EXIT_FAILURE);
+                }
+                current.token = token;
+                current.name = internPath(name);
+                if(insertCommand(&current))
                     break;
+                fclose(file);
                 return;
-            
+
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-                return;
-            
             case 'd':
                 if(numTokens != 2)
                     errorParse();
-                if(insertCommand(line))
+                current.token = token;
+                current.name = internPath(name);
+                if(insertCommand(&current))
                     break;
+                fclose(file);
                 return;
-            
+
             case '#':
                 break;
-            
+
             default: { /* error */
                 errorParse();
             }
@@ -175,42 +291,25 @@ void applyCommands(){
     assert__(pthread_mutex_lock(&mtx_lock) == 0, "Error: thread failed to lock using mutex!\n")
     while (numberCommands > 0){
 
-        const char* command = removeCommand();
+        command* current = removeCommand();
         assert__(pthread_mutex_unlock(&mtx_lock) == 0, "Error: thread failed to unlock using mutex!\n")
 
-        if (command == NULL){
+        if (current == NULL){
             continue;
         }
 
-        char token, type;
-        char name[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %c", &token, name, &type);
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
-        }
+        char* name = pathAt(current->name);
 
         int searchResult;
-        switch (token) {
+        switch (current->token) {
             case 'c':
-
-                switch (type) {
-                    case 'f':
-                        lock(WRITING);
-                        printf("Create file: %s\n", name);
-                        create(name, T_FILE);
-                        unlock();
-                        break;
-                    case 'd':
-                        lock(WRITING);
-                        printf("Create directory: %s\n", name);
-                        create(name, T_DIRECTORY);
-                        unlock();
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                }
+                lock(WRITING);
+                if (current->nodeType == T_FILE)
+                    printf("Create file: %s\n", name);
+                else
+                    printf("Create directory: %s\n", name);
+                create(name, current->nodeType);
+                unlock();
                 break;
 
             case 'l':
@@ -306,6 +405,9 @@ int main(int argc, char* argv[]) {
 
     /* release allocated memory */
     destroy_fs();
+    free(inputCommands);
+    free(pathArena);
+    free(pathTable);
 
     /* Destroys locks */
     pthread_mutex_destroy(&mtx_lock);
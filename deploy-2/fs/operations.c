@@ -383,17 +383,18 @@ int move(char* from, char* to) {
     /* tries to get child inumber. it can be 'FAIL' if not found */
     child_from_inumber = lookup_sub_node(child_from, pdata_from.dirEntries);
 
-    /* locks (write) the directory/file that will be moved */
-    assert__(lock_write(child_from_inumber) == SUCCESS, "Error: move failed to lock an inode!\n")
-    locked_inumbers[amount++] = child_from_inumber;
-
-    /* if we couldn't find the node that is going to be moves, we show an error */
+    /* if we couldn't find the node that is going to be moves, we show an error. checked before
+     * locking it, as there is no i-node to lock */
     if (child_from_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, child_from does not exist in dir %s\n", child_from, parent_from);
         return FAIL;
     }
 
+    /* locks (write) the directory/file that will be moved */
+    assert__(lock_write(child_from_inumber) == SUCCESS, "Error: move failed to lock an inode!\n")
+    locked_inumbers[amount++] = child_from_inumber;
+
     /* since we already have the child's inumber, we can get it's information */
     inode_get(child_from_inumber, &cType_from, &cdata_from);
 
@@ -1,105 +1,199 @@
+#define _GNU_SOURCE  /* pthread_setaffinity_np */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include "fs/operations.h"
 #include <sys/time.h>
 
-#define MAX_COMMANDS 10
+#define MAX_COMMANDS 16  /* power of 2, so positions wrap with a mask */
 #define MAX_INPUT_SIZE 100
 
 int numberThreads = 0;
 
-char inputCommands[MAX_COMMANDS][MAX_INPUT_SIZE];
+/* token of the command that tells a thread there is nothing left to apply */
+#define TOKEN_EOF 'e'
 
-int numberCommands = 0;
+/*
+ * Command already parsed by processInput, so threads apply it straight away. Paths are offsets
+ * given by internPath, where each distinct path is kept once
+ */
+typedef struct command {
+    char token;  /* 'c', 'l', 'd', 'm' or TOKEN_EOF */
+    type nodeType;  /* type of the node to create */
+    int name;
+    int name_2;  /* destination of a move */
+} command;
+
+/*
+ * Slot of the command ring. seq tells whose turn it is: a producer may fill the slot taken at
+ * position pos once seq is pos, and a consumer may empty it once seq is pos + 1
+ */
+typedef struct commandSlot {
+    unsigned long seq;
+    command data;
+} commandSlot;
 
-int insertQueue = 0;
+commandSlot inputCommands[MAX_COMMANDS];
 
-int removeQueue = 0;
+/* next positions to fill and to empty. they only grow, each thread takes its own with an atomic add */
+unsigned long insertQueue = 0;
+unsigned long removeQueue = 0;
+
+/* interned paths, each one followed by its '\0'. threads read them while new ones are added, so
+ * chunks never move and a path never spans two of them */
+#define PATH_CHUNK_SIZE (64 * 1024)
+#define MAX_PATH_CHUNKS 4096
+char *pathChunks[MAX_PATH_CHUNKS];
+int numberChunks = 0, chunkUsed = PATH_CHUNK_SIZE;
+
+/* open addressing table of the interned paths (offsets, -1 if the bucket is empty). only used by
+ * processInput */
+int *pathTable = NULL;
+int pathTableSize = 0, numberPaths = 0;
 
 /* file paths */
 char *input_file_path;
 char *output_file_path;
 
-/* used only for loop synchronization */
-pthread_mutex_t lock_remove = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t lock_insert = PTHREAD_MUTEX_INITIALIZER;
+/* CPUs the threads are pinned to, in turn (none if pinnedCount is 0) */
+int pinnedCpus[CPU_SETSIZE];
+int pinnedCount = 0;
 
-/* conditional variables */
-pthread_cond_t cond_thread, cond_commands;
+/* free slots and commands waiting in inputCommands. only used to sleep when the ring is full or empty */
+sem_t sem_slots, sem_commands;
 
 
 /*
- * Inserts a command in in inputCommands[]
+ * Inserts a command in inputCommands[]. No lock is taken: the slot is claimed with an atomic add,
+ * so several threads may insert at once
  * Input:
  *  - data: command to be inserted
  * Returns:
  *  1
  */
-int insertCommand(char* data) {
-    assert__(pthread_mutex_lock(&lock_insert) == 0, "Error: insertCommand failed to lock!\n")
+int insertCommand(command* data) {
 
-    /* wait if all commands in inputCommands are being executed */
-    while(numberCommands == MAX_COMMANDS-1){
-        pthread_cond_wait(&cond_commands, &lock_insert);
-    }
+    /* wait if all slots of inputCommands are taken */
+    while (sem_wait(&sem_slots) != 0);
 
-    /* inserts a new command in inputCommands */
-    strcpy(inputCommands[insertQueue], data);
+    unsigned long pos = __atomic_fetch_add(&insertQueue, 1, __ATOMIC_RELAXED);
+    commandSlot *slot = &inputCommands[pos & (MAX_COMMANDS - 1)];
 
-    insertQueue++;
+    /* the consumer of the previous round may still be copying the slot out */
+    while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos)
+        sched_yield();
 
-    /* if insertQueue has reached the end of inputCommands, return to the beginning */
-    if(insertQueue == MAX_COMMANDS)
-        insertQueue = 0;
+    slot->data = *data;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
 
-    numberCommands++;
-
-    /* signal to removeCommand, so that new command is executed */
-    pthread_cond_signal(&cond_thread);
-    assert__(pthread_mutex_unlock(&lock_insert) == 0, "Error: insertCommand failed to unlock!\n")
+    /* wakes a thread waiting in removeCommand */
+    assert__(sem_post(&sem_commands) == 0, "Error: insertCommand failed to post!\n")
 
     return 1;
 }
 
 
 /*
- * Removes a command from inputCommands[] for it to be applied
- * Returns:
- *  - command to apply
+ * Removes a command from inputCommands[] for it to be applied. No lock is held once it returns,
+ * so commands are applied in parallel, each one only taking the locks of the i-nodes it touches
+ * Input:
+ *  - current: gets the command to apply
  */
-char* removeCommand() {
+void removeCommand(command *current) {
 
-    char* currentCommand;
+    /* wait while there are no commands to execute */
+    while (sem_wait(&sem_commands) != 0);
 
-    /* mutex lock (unlock at line 221 and 169) */
-    assert__(pthread_mutex_lock(&lock_remove) == 0, "Error: removeCommand failed to lock!\n")
+    unsigned long pos = __atomic_fetch_add(&removeQueue, 1, __ATOMIC_RELAXED);
+    commandSlot *slot = &inputCommands[pos & (MAX_COMMANDS - 1)];
 
-    /* wait while there are no commands to execute */
-    while(numberCommands == 0){
-        pthread_cond_wait(&cond_thread, &lock_remove);
-    }
+    /* the producer that took this position may still be copying the command in */
+    while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        sched_yield();
 
-    currentCommand = inputCommands[removeQueue];
+    *current = slot->data;
+    __atomic_store_n(&slot->seq, pos + MAX_COMMANDS, __ATOMIC_RELEASE);
+
+    /* in case insertCommand is waiting, signal to proceed */
+    assert__(sem_post(&sem_slots) == 0, "Error: removeCommand failed to post!\n")
+}
+
+
+/* hashes a path (djb2) */
+unsigned int hashPath(char *path) {
+    unsigned int hash = 5381;
+    while (*path != '\0')
+        hash = hash * 33 + (unsigned char) *path++;
+    return hash;
+}
 
-    /* if command is "EOF", inputCommands has reached it's end */
-    if(strcmp(currentCommand, "EOF") == 0){
-        return currentCommand;
-    }
 
-    removeQueue++;
+/*
+ * Returns: the path at an offset given by internPath
+ */
+char* pathAt(int offset) {
+    return pathChunks[offset / PATH_CHUNK_SIZE] + offset % PATH_CHUNK_SIZE;
+}
+
+
+/* puts an offset in its bucket of pathTable, which must have room for it */
+void placePath(int offset) {
+    unsigned int bucket = hashPath(pathAt(offset)) & (pathTableSize - 1);
+    while (pathTable[bucket] != -1)
+        bucket = (bucket + 1) & (pathTableSize - 1);
+    pathTable[bucket] = offset;
+}
+
+
+/*
+ * Keeps a path with the interned ones, unless it is already there. Only called by processInput
+ * Input:
+ *  - path: path read from the input file
+ * Returns:
+ *  offset of the path, for pathAt
+ */
+int internPath(char *path) {
+
+    /* the table is doubled when half full, so buckets are found after a few probes */
+    if (2 * (numberPaths + 1) > pathTableSize) {
+        int *oldTable = pathTable, oldSize = pathTableSize;
+
+        pathTableSize = oldSize > 0 ? 2 * oldSize : 1024;
+        pathTable = malloc(pathTableSize * sizeof(int));
+        assert__(pathTable != NULL, "Error: out of memory for paths.\n")
+        memset(pathTable, -1, pathTableSize * sizeof(int));
+
+        for (int i = 0; i < oldSize; i++)
+            if (oldTable[i] != -1) placePath(oldTable[i]);
+        free(oldTable);
+    }
 
-    /* if removeQueue has reached the end of inputCommands, return to the beginning */
-    if(removeQueue == MAX_COMMANDS)
-        removeQueue = 0;
+    unsigned int bucket = hashPath(path) & (pathTableSize - 1);
+    while (pathTable[bucket] != -1) {
+        if (strcmp(pathAt(pathTable[bucket]), path) == 0)
+            return pathTable[bucket];
+        bucket = (bucket + 1) & (pathTableSize - 1);
+    }
 
-    numberCommands--;
+    int length = strlen(path) + 1;
+    if (chunkUsed + length > PATH_CHUNK_SIZE) {
+        assert__(numberChunks < MAX_PATH_CHUNKS, "Error: too many paths.\n")
+        pathChunks[numberChunks] = malloc(PATH_CHUNK_SIZE);
+        assert__(pathChunks[numberChunks] != NULL, "Error: out of memory for paths.\n")
+        numberChunks++;
+        chunkUsed = 0;
+    }
 
-    /* in case insertCommand is 'waiting', signal to proceed */
-    pthread_cond_signal(&cond_commands);
+    int offset = (numberChunks - 1) * PATH_CHUNK_SIZE + chunkUsed;
+    memcpy(pathChunks[numberChunks - 1] + chunkUsed, path, length);
+    chunkUsed += length;
 
-    return currentCommand;  
+    pathTable[bucket] = offset;
+    numberPaths++;
+    return offset;
 }
 
 
@@ -110,10 +204,11 @@ void errorParse(){
 
 
 /*
- * Processes input file
+ * Processes input file, turning each line into a command. Lines are only parsed here
  */
 void processInput(){
     char line[MAX_INPUT_SIZE];
+    command current;
 
     /* opens input file */
     FILE *file = fopen(input_file_path, "r");
@@ -135,28 +230,40 @@ void processInput(){
             case 'c':
                 if(numTokens != 3)
                     errorParse();
-                if(insertCommand(line))
+                switch (type[0]) {
+                    case 'f':
+                        current.nodeType = T_FILE;
+                        break;
+                    case 'd':
+                        current.nodeType = T_DIRECTORY;
+                        break;
+                    default:
+                        fprintf(stderr, "Error: invalid node type\n");
+                        exit(EXIT_FAILURE);
+                }
+                current.token = token;
+                current.name = internPath(name);
+                if(insertCommand(&current))
                     break;
                 return;
             
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                if(insertCommand(line))
-                    break;
-                return;
-            
             case 'd':
                 if(numTokens != 2)
                     errorParse();
-                if(insertCommand(line))
+                current.token = token;
+                current.name = internPath(name);
+                if(insertCommand(&current))
                     break;
                 return;
 
             case 'm':
                 if (numTokens != 3)
                     errorParse();
-                if (insertCommand(line))
+                current.token = token;
+                current.name = internPath(name);
+                current.name_2 = internPath(type);
+                if (insertCommand(&current))
                     break;
                 return;
             
@@ -168,10 +275,10 @@ void processInput(){
             }
         }
     } 
-    /* file has reached it's end, no more commands to execute, put "EOF" to end loops*/
-    insertCommand("EOF");
-
-    numberCommands++;   
+    /* file has reached it's end, no more commands to execute, put one "EOF" per thread to end loops */
+    current.token = TOKEN_EOF;
+    for (int i = 0; i < numberThreads; i++)
+        insertCommand(&current);
 
     /* closes file for good measure */
     fclose(file);          
@@ -186,42 +293,24 @@ void applyCommands(){
     /* loop until file has reached it's end */
     while (1) {
 
-        const char* command = removeCommand();
+        command current;
+        removeCommand(&current);
 
-        /* if command is "EOF" there are no more commands to execute, break loop and all threads must exit */
-        if (strcmp(command, "EOF") == 0) {
-            numberCommands = 1;
-            assert__(pthread_mutex_unlock(&lock_remove) == 0, "Error: removeCommand failed to unlock!\n")
-            pthread_cond_signal(&cond_thread);
+        /* if command is "EOF" there are no more commands to execute, break loop. each thread gets its own */
+        if (current.token == TOKEN_EOF) {
             pthread_exit(NULL);
         }
 
-        char token;
-        char name_2[MAX_INPUT_SIZE];
-        char name_1[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %s", &token, name_1, name_2);
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
-        }
+        char* name_1 = pathAt(current.name);
 
         int searchResult;
-        switch (token) {
+        switch (current.token) {
             case 'c':
-
-                switch (name_2[0]) {
-                    case 'f':
-                        printf("Create file: %s\n", name_1);
-                        create(name_1, T_FILE);
-                        break;
-                    case 'd':
-                        printf("Create directory: %s\n", name_1);
-                        create(name_1, T_DIRECTORY);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                }
+                if (current.nodeType == T_FILE)
+                    printf("Create file: %s\n", name_1);
+                else
+                    printf("Create directory: %s\n", name_1);
+                create(name_1, current.nodeType);
                 break;
 
             case 'l':
@@ -237,7 +326,7 @@ void applyCommands(){
 
             case 'm':
                 printf("Move: %s\n", name_1);
-                move(name_1, name_2);
+                move(name_1, pathAt(current.name_2));
                 break;
 
             default: { /* error */
@@ -246,15 +335,57 @@ void applyCommands(){
             }
 
         }
+    }
+}
 
-        assert__(pthread_mutex_unlock(&lock_remove) == 0, "Error: removeCommand failed to unlock!\n")
 
+/*
+ * Reads a list of CPUs such as "0-3,8,10-11".
+ * Input:
+ *  - list: list given on the command line
+ * Returns:
+ *  number of CPUs, kept in pinnedCpus in the order given, or -1 if the list is invalid
+ */
+int parseCpuList(char *list) {
+    int count = 0;
+
+    while (*list != '\0') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (end == list) return -1;
+
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE || count + (last - first + 1) > CPU_SETSIZE) return -1;
+
+        for (long cpu = first; cpu <= last; cpu++) pinnedCpus[count++] = (int) cpu;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        list = end;
     }
+
+    return count > 0 ? count : -1;
 }
 
 
-/* auxiliary function used to redirect a thread to the applyCommands function */
+/* auxiliary function used to redirect a thread to the applyCommands function. threads are
+ * pinned, if asked to, before touching anything, so the directories they create are allocated
+ * on the NUMA node of their CPU */
 void *applyCommand_thread(void* ptr) {
+    int index = *(int *) ptr;
+
+    if (pinnedCount > 0) {
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        CPU_SET(pinnedCpus[index % pinnedCount], &cpu);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) != 0)
+            fprintf(stderr, "Warning: couldn't pin a thread to CPU %d\n", pinnedCpus[index % pinnedCount]);
+    }
+
     applyCommands();
     return NULL;
 }
@@ -265,17 +396,22 @@ int main(int argc, char* argv[]) {
     struct timeval start, end;
     gettimeofday(&start, NULL);
 
-    /* checks if the user inserted the correct amount of inputs */
-    assert__(argc == 4, "Error: need 4 inputs.\n")
+    /* checks if the user inserted the correct amount of inputs (the list of CPUs is optional) */
+    assert__(argc == 4 || argc == 5, "Error: need 4 inputs.\n")
+    if (argc == 5)
+        assert__((pinnedCount = parseCpuList(argv[4])) > 0, "Error: CPUs must be given as a list such as 0-3,8.\n")
 
-    /* init condition variables*/
-    pthread_cond_init(&cond_thread, NULL);
-    pthread_cond_init(&cond_commands, NULL);
+    /* init semaphores and the turns of each slot of inputCommands */
+    sem_init(&sem_slots, 0, MAX_COMMANDS);
+    sem_init(&sem_commands, 0, 0);
+    for (int i = 0; i < MAX_COMMANDS; i++)
+        inputCommands[i].seq = i;
 
     /* holds info about each thread id */
     numberThreads = atoi(argv[3]);
     assert__(numberThreads > 0, "Error: program needs to have more than zero threads.\n")
     pthread_t thread_ids[numberThreads];
+    int thread_indexes[numberThreads];
 
     /* gets path to our input file and our output file from the command line */
     input_file_path = argv[1];
@@ -289,8 +425,10 @@ int main(int argc, char* argv[]) {
     init_fs();
 
     /* creates all the requested threads. if it fails, reports an error */
-    for (int i = 0; i < numberThreads; i++)
-        assert__(pthread_create(&thread_ids[i], NULL, applyCommand_thread, NULL) == 0, "Error: couldn't create a thread.\n")
+    for (int i = 0; i < numberThreads; i++) {
+        thread_indexes[i] = i;
+        assert__(pthread_create(&thread_ids[i], NULL, applyCommand_thread, &thread_indexes[i]) == 0, "Error: couldn't create a thread.\n")
+    }
 
     /* process input and print tree */
     processInput();
@@ -312,11 +450,14 @@ int main(int argc, char* argv[]) {
     print_tecnicofs_tree(file);
     fclose(file);
 
-    pthread_cond_destroy(&cond_thread);
-    pthread_cond_destroy(&cond_commands);
+    sem_destroy(&sem_slots);
+    sem_destroy(&sem_commands);
 
     /* release allocated memory */
     destroy_fs();
+    for (int i = 0; i < numberChunks; i++)
+        free(pathChunks[i]);
+    free(pathTable);
 
     /* time of execution on the requested format */
     printf("TecnicoFS completed in %.4f seconds.\n", final_time);
@@ -0,0 +1,68 @@
+#!/bin/bash
+#Compares thread placements on the same input: unpinned, packed on the first NUMA node and
+#spread over every node. On hosts with more than one socket the difference between the last
+#two is the cost of sharing the inode table across sockets
+if [ $# -eq 2 ] || [ $# -eq 3 ]
+then
+	#checks if the first argument is an existing file
+	if [ -f "$1" ]
+	then
+		inputfile=$1
+	else
+		echo Input file does not exist.
+		exit 1
+	fi
+	#checks if second argument is an integer and if it is greater than zero
+	if [ $2 -eq $2 2>/dev/null ] && [ $2 -gt 0 ]
+	then
+		numthreads=$2
+	else
+		echo "Incorrect number of threads. (2nd argument)"
+		exit 1
+	fi
+	runs=${3:-5}
+
+	#expands a list such as 0-3,8 into one CPU per line
+	expand() {
+		tr ',' '\n' <<< "$1" | while IFS=- read first last
+		do
+			seq $first ${last:-$first}
+		done
+	}
+
+	nodes=$(ls -d /sys/devices/system/node/node[0-9]* 2>/dev/null)
+	if [ -z "$nodes" ]
+	then
+		nodes=none
+	fi
+	echo Nodes: $(echo $nodes | wc -w)
+
+	#packed: the first CPUs of the first node. spread: one CPU of each node in turn
+	first=$(echo $nodes | cut -d' ' -f1)
+	if [ "$first" = none ]
+	then
+		packed=$(seq 0 $(($(nproc) - 1)) | head -n $numthreads | paste -sd,)
+		spread=$packed
+	else
+		packed=$(expand $(cat $first/cpulist) | head -n $numthreads | paste -sd,)
+		spread=$(for node in $nodes; do expand $(cat $node/cpulist) | head -n $numthreads | nl -nln; done \
+			| sort -n -s -k1,1 | awk '{print $2}' | head -n $numthreads | paste -sd,)
+	fi
+
+	for placement in none packed spread
+	do
+		case $placement in
+			none) cpus= ;;
+			packed) cpus=$packed ;;
+			spread) cpus=$spread ;;
+		esac
+		average=$(for run in $(seq 1 $runs)
+		do
+			./tecnicofs $inputfile /dev/null $numthreads $cpus | grep "TecnicoFS completed"
+		done | awk '{ total += $4 } END { printf "%.4f", total / NR }')
+		echo Placement=$placement CPUs=${cpus:-any} AverageTime=$average
+	done
+else
+	echo "Wrong number of arguments. (2 or 3)"
+	exit 1
+fi
@@ -16,6 +16,8 @@ then
 	for inputfile in ${inputdir}/*.txt
 	do
 		filename=$(basename ${inputfile})
+		#expected outputs of runTests.sh sit next to the inputs
+		[[ $filename == *_out.txt ]] && continue
 		echo Exectuting $inputfile
 		./tecnicofs-client $inputfile $server
 	done
@@ -1,32 +1,130 @@
+#define _GNU_SOURCE  /* memfd_create */
 #include "tecnicofs-client-api.h"
+#include "../tecnicofs-protocol.h"
+#include "../tecnicofs-shm.h"
+#include "../tecnicofs-namespace.h"
+#include "../tecnicofs.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
 
 
-/* holds server socket address */
-struct sockaddr_un server_socket;
+/* request sent with one of the tfs*Async calls whose response wasn't returned by tfsWait yet */
+typedef struct in_flight {
+    uint32_t id;  /* 0 if the slot is free */
+    int done;  /* 1 once the response arrived */
+    int status;
+} in_flight;
 
-/* size of server socket */
-socklen_t serv_len = sizeof(struct sockaddr_un);
+/*
+ * Connection of a client to the server. Each session has its own socket and buffers, so
+ * sessions can be used by different threads at the same time; a single session can't.
+ */
+struct tfs_session {
+
+    /* 1 if the session runs the engine in this process instead of talking to a server */
+    int embedded;
+
+    /* holds server socket address */
+    struct sockaddr_un server_socket;
+
+    /* size of server socket */
+    socklen_t serv_len;
+
+    /* 1 if the server accepted a seqpacket connection, 0 if datagrams are sent to it */
+    int connected;
+
+    /* holds client socket file descriptor */
+    int client_fd;
+
+    /* holds client socket path */
+    char client_path[30];
+
+    /* region the requests go through once the server attached it (NULL while on the socket) */
+    tfs_shm_region *shm;
+
+    /* spinning rounds before sleeping on the region's doorbell */
+    int shm_spin;
+
+    /* namespace mirror of the server, mapped read-only (NULL if it doesn't publish one) */
+    tfs_ns_region *ns;
+    size_t ns_size;
+
+    /* id of the last request sent */
+    uint32_t request_id;
+
+    /* milliseconds a call waits for its response, also sent as the request's deadline (0 waits
+     * forever) */
+    int timeout_ms;
+
+    /* 1 if the last response wasn't received because the timeout passed */
+    int timed_out;
+
+    /* holds message that is going to be sent to the server */
+    char request[TFS_MAX_MESSAGE];
 
-/* holds client socket file descriptor */
-int client_fd;
+    /* holds the last message received from the server. the union keeps it aligned for the header */
+    union {
+        tfs_response_header header;
+        char bytes[TFS_MAX_MESSAGE];
+    } response;
 
-/* holds client socket path */
-char client_path[30] = "/tmp/";
+    /* requests in flight. their ids are the tickets given to the caller */
+    in_flight in_flight_table[TFS_MAX_IN_FLIGHT];
+    int in_flight_count;
 
-/* holds number of bytes sent */
-int c;
+    /* requests in flight whose response didn't arrive yet */
+    int in_flight_waiting;
 
-/* holds server output. uses an array for simplicity */
-int output[1];
+    /* 1 between tfsBatchBegin and tfsBatchSubmit, while operations are being collected */
+    int batch_open;
 
-/* holds line that is going to be sent to the server */
-char line[MAX_INPUT_SIZE];
+    /* batch being collected: header followed by the requests of its operations */
+    char batch[TFS_MAX_MESSAGE];
+    int batch_size;
+    int batch_count;
+
+    /* id of the request of the current stream */
+    uint32_t stream_id;
+
+    /* bytes of the last stream message not yet returned by tfsDumpNext */
+    char *stream_pos;
+    int stream_left;
+
+    /* 1 while the server still has messages to send for the current stream */
+    int stream_more;
+
+    /* status reported by the server at the end of the current stream */
+    int stream_status;
+
+    /* sequence number of the last print of changes run by an embedded session */
+    int64_t changes_seq;
+
+    /* path returned by tfsDumpNext. grows when a path is longer than the ones before */
+    char *stream_path;
+    int stream_path_size;
+
+    /* whole dump of an embedded session, read by tfsDumpNext as if it was one message */
+    char *dump;
+    size_t dump_size;
+    size_t dump_capacity;
+};
+
+/* session opened by tfsMount and used by the calls that don't take one */
+tfs_session *default_session = NULL;
+
+/* number of sessions opened by this process, used to give each one its own socket path */
+int session_count = 0;
 
 
 /*
@@ -51,214 +149,1242 @@ int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
 
 
 /*
- * Sends message to tecnicofs server telling it to create a file/directory.
+ * Gets the id of a new request. Ids stay positive so they can be returned as tickets.
  *
  * Input:
- *   - filename: file/directory path that is going to be created
- *   - nodeType: f, creates a file and d, creates a directory
+ *   - session: session sending the request
  * Output:
- *   - SUCCESS or FAIL
+ *   - request id
  * */
-int tfsCreate(char *filename, char nodeType) {
+uint32_t next_request_id(tfs_session *session) {
+    if (session->request_id == INT32_MAX) session->request_id = 0;
+    return ++session->request_id;
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "c ");
-    strcat(line, filename);
-    strcat(line, " ");
-    strcat(line, &nodeType);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line)+1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Finds the in flight request with the given id.
+ *
+ * Input:
+ *   - session: session that sent the request
+ *   - id: request id (0 finds a free slot)
+ * Output:
+ *   - slot of the request or NULL if there is none
+ * */
+in_flight *in_flight_find(tfs_session *session, uint32_t id) {
+    for (int i = 0; i < TFS_MAX_IN_FLIGHT; i++)
+        if (session->in_flight_table[i].id == id) return &session->in_flight_table[i];
+    return NULL;
+}
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsCreate had an error and couldn't send message!\n")
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+/*
+ * Input:
+ *   - session: session sending a request now
+ * Output:
+ *   - deadline of the request, or 0 if the session waits forever
+ * */
+uint32_t request_deadline(tfs_session *session) {
+    return session->timeout_ms > 0 ? tfs_deadline(session->timeout_ms) : 0;
+}
 
-    return output[0];
+
+/*
+ * Input:
+ *   - session: session whose last response wasn't received
+ * Output:
+ *   - TECNICOFS_ERROR_TIMEOUT if the timeout passed, TECNICOFS_ERROR_CONNECTION_ERROR otherwise
+ * */
+int receive_error(tfs_session *session) {
+    return session->timed_out ? TECNICOFS_ERROR_TIMEOUT : TECNICOFS_ERROR_CONNECTION_ERROR;
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to delete a file/directory.
+ * Writes a request in the wire format: a fixed header followed by the paths, each one with its
+ * '\0'.
  *
  * Input:
- *   - path: file path that is going to be deleted
+ *   - message: buffer with TFS_MAX_MESSAGE bytes
+ *   - opcode: OP_* code of the operation
+ *   - flags: TFS_FLAG_* flags
+ *   - id: request id
+ *   - arg: numeric argument of the operation
+ *   - deadline: time after which the server can drop the request (0 for none)
+ *   - path_1, path_2: paths of the operation (NULL if unused)
  * Output:
- *   - SUCCESS or FAIL
+ *   - size of the message or -1 if a path is too long
  * */
-int tfsDelete(char *path) {
+int encode_request(char *message, uint8_t opcode, uint16_t flags, uint32_t id, int64_t arg, uint32_t deadline,
+                   char *path_1, char *path_2) {
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "d ");
-    strcat(line, path);
-    strcat(line, "\0");
+    tfs_request_header header = { TFS_PROTOCOL_VERSION, opcode, flags, id, arg, { 0, 0 }, deadline };
+    char *paths[2] = { path_1, path_2 };
+    int size = sizeof(header);
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+    for (int i = 0; i < 2; i++) {
+        if (paths[i] == NULL) continue;
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsDelete had an error and couldn't send message!\n")
+        int path_size = (int) strlen(paths[i]) + 1;
+        if (path_size > MAX_PATH_SIZE) return -1;
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+        header.path_size[i] = path_size;
+        memcpy(message + size, paths[i], path_size);
+        size += path_size;
+    }
 
-    return output[0];
+    memcpy(message, &header, sizeof(header));
+    return size;
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to move a file/directory.
+ * Checks if the server of a shared memory session is still there.
  *
  * Input:
- *   - from: file/directory that is going to be moved
- *   - to: new path for the input file/directory
+ *   - region: region of the session
  * Output:
- *   - SUCCESS or FAIL
+ *   - 1 if it is, 0 if it died
  * */
-int tfsMove(char *from, char *to) {
+int shm_server_alive(tfs_shm_region *region) {
+    return kill(region->server_pid, 0) == 0 || errno != ESRCH;
+}
+
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "m ");
-    strcat(line, from);
-    strcat(line, " ");
-    strcat(line, to);
-    strcat(line, "\0");
+/*
+ * Takes the next message of the response ring, waiting for one, into the response buffer.
+ * The timeout of the session is checked each time the doorbell wakes the client, which is at
+ * least every TFS_SHM_LIVENESS_MS.
+ *
+ * Input:
+ *   - session: session attached to a region
+ * Output:
+ *   - size of the message or -1 if the server is gone or the timeout passed
+ * */
+int shm_receive(tfs_session *session) {
+    tfs_shm_region *region = session->shm;
+    uint32_t deadline = request_deadline(session);
+
+    while (1) {
+        uint32_t seen = __atomic_load_n(&region->client_bell.seq, __ATOMIC_ACQUIRE);
+        uint32_t size;
+        char *message = tfs_shm_peek(&region->responses, &size);
+
+        if (message != NULL) {
+            if (size > sizeof(session->response.bytes)) return -1;
+
+            memcpy(session->response.bytes, message, size);
+            tfs_shm_release(&region->responses, size);
+            tfs_shm_ring_bell(&region->server_bell);  /* the server may be waiting for room */
+            return (int) size;
+        }
+
+        if (! tfs_shm_wait(&region->client_bell, seen, &session->shm_spin) && ! shm_server_alive(region)) return -1;
+        if (deadline != 0 && tfs_time_left(deadline) <= 0) {
+            session->timed_out = 1;
+            return -1;
+        }
+    }
+}
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsMove had an error and couldn't send message!\n")
+int receive_response(tfs_session *session, uint32_t id);
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
 
-    return output[0];
+/*
+ * Writes a message to the request ring. While the ring is full the server is handling what is
+ * already there, and may be waiting for room to answer it, so responses to requests in flight
+ * are received meanwhile.
+ *
+ * Input:
+ *   - session: session attached to a region
+ *   - message: bytes to send
+ *   - size: number of bytes
+ * Output:
+ *   - 1 if the message was sent, 0 otherwise
+ * */
+int shm_send(tfs_session *session, char *message, int size) {
+    tfs_shm_region *region = session->shm;
+
+    while (1) {
+        uint32_t seen = __atomic_load_n(&region->client_bell.seq, __ATOMIC_ACQUIRE);
+        char *slot = tfs_shm_reserve(&region->requests, size);
+
+        if (slot != NULL) {
+            memcpy(slot, message, size);
+            tfs_shm_commit(&region->requests, size);
+            tfs_shm_ring_bell(&region->server_bell);
+            return 1;
+        }
+
+        uint32_t pending;
+        if (session->in_flight_waiting > 0 && tfs_shm_peek(&region->responses, &pending) != NULL) {
+            if (! receive_response(session, 0)) return 0;
+        }
+        else if (! tfs_shm_wait(&region->client_bell, seen, &session->shm_spin) && ! shm_server_alive(region)) return 0;
+    }
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to lookup a file/directory.
+ * Waits for the response to a request. Responses to requests in flight that arrive meanwhile
+ * are kept for tfsWait and late responses to anything else are discarded. Sessions with a
+ * timeout give up once it passes; the socket's SO_RCVTIMEO ends each wait for a message.
  *
  * Input:
- *   - path: file/directory that is going to be searched
+ *   - session: session that sent the request
+ *   - id: id of the request, or 0 to return after the first response
  * Output:
- *   - SUCCESS or FAIL
+ *   - 1 if the response was received in the response buffer, 0 otherwise (with timed_out set
+ *     if the timeout passed)
  * */
-int tfsLookup(char *path) {
+int receive_response(tfs_session *session, uint32_t id) {
+    uint32_t deadline = request_deadline(session);
+    session->timed_out = 0;
+
+    while (1) {
+        int c = session->shm != NULL ? shm_receive(session)
+                : recvfrom(session->client_fd, session->response.bytes, sizeof(session->response.bytes), 0, NULL, NULL);
+        if (c < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) session->timed_out = 1;
+        if (c < (int) sizeof(tfs_response_header)) return 0;
+        if (id != 0 && session->response.header.request_id == id) return 1;
+
+        uint32_t response_id = session->response.header.request_id;
+        in_flight *request = response_id != 0 ? in_flight_find(session, response_id) : NULL;
+        if (request != NULL && ! request->done) {
+            request->done = 1;
+            request->status = session->response.header.status;
+            session->in_flight_waiting--;
+        }
+
+        if (id == 0) return 1;
+
+        /* late responses to other requests don't extend the wait */
+        if (deadline != 0 && tfs_time_left(deadline) <= 0) {
+            session->timed_out = 1;
+            return 0;
+        }
+    }
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "l ");
-    strcat(line, path);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Sends a message to the server. Sockets only queue a few messages, so while requests are in
+ * flight the server may be blocked answering them and unable to take new ones. Their responses
+ * are then received until the message is accepted.
+ *
+ * Input:
+ *   - session: session sending the message
+ *   - message: bytes to send
+ *   - size: number of bytes
+ * Output:
+ *   - 1 if the message was sent, 0 otherwise
+ * */
+int send_message(tfs_session *session, char *message, int size) {
+    if (session->shm != NULL) return shm_send(session, message, size);
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsLookup had an error and couldn't send message!\n")
+    struct sockaddr *server = session->connected ? NULL : (struct sockaddr *) &session->server_socket;
+    socklen_t serv_len = session->connected ? 0 : session->serv_len;
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+    while (session->in_flight_waiting > 0) {
+        if (sendto(session->client_fd, message, size, MSG_DONTWAIT | MSG_NOSIGNAL, server, serv_len) >= 0) return 1;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+        if (! receive_response(session, 0)) return 0;
+    }
 
-    return output[0];
+    return sendto(session->client_fd, message, size, MSG_NOSIGNAL, server, serv_len) >= 0;
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to print it's tree.
+ * Adds an operation to the batch being collected.
  *
  * Input:
- *   - out_file: file where the contents will be written
+ *   - session: session collecting the batch
+ *   - opcode: OP_* code of the operation
+ *   - flags: TFS_FLAG_* flags
+ *   - arg: numeric argument of the operation
+ *   - path_1, path_2: paths of the operation (NULL if unused)
  * Output:
- *   - SUCCESS or FAIL
+ *   - position of the operation in the batch or TECNICOFS_ERROR_OTHER if it doesn't fit
  * */
-int tfsPrint(char* out_file) {
+int batch_append(tfs_session *session, uint8_t opcode, uint16_t flags, int64_t arg, char *path_1, char *path_2) {
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "p ");
-    strcat(line, out_file);
-    strcat(line, "\0");
+    /* encodes into a scratch buffer, since the space left in the batch may be too small */
+    int size = encode_request(session->request, opcode, flags, 0, arg, 0, path_1, path_2);
+    if (size < 0 || session->batch_count == TFS_MAX_BATCH || session->batch_size + size > TFS_MAX_MESSAGE)
+        return TECNICOFS_ERROR_OTHER;
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+    memcpy(session->batch + session->batch_size, session->request, size);
+    session->batch_size += TFS_ALIGN(size);
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsPrint had an error and couldn't send message!\n")
+    return session->batch_count++;
+}
+
+
+/*
+ * Runs an operation in the engine of this process, as the server would. With a timeout, the
+ * operation gives up on locks it couldn't take by then.
+ *
+ * Input:
+ *   - session: embedded session
+ *   - opcode: OP_* code of the operation
+ *   - flags: TFS_FLAG_* flags
+ *   - arg: numeric argument of the operation
+ *   - path_1, path_2: paths of the operation (NULL if unused)
+ * Output:
+ *   - result of the operation or TECNICOFS_ERROR_* code
+ * */
+int embedded_execute(tfs_session *session, uint8_t opcode, uint16_t flags, int64_t arg, char *path_1, char *path_2) {
+
+    if (session->timeout_ms > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += session->timeout_ms / 1000;
+        deadline.tv_nsec += (session->timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        tecnicofs_set_deadline(&deadline);
+    }
+
+    int result;
+    switch (opcode) {
+        case OP_CREATE:
+            result = tecnicofs_create(path_1, flags & TFS_FLAG_DIRECTORY ? T_DIRECTORY : T_FILE);
+            break;
+        case OP_DELETE:
+            result = tecnicofs_delete(path_1);
+            break;
+        case OP_LOOKUP:
+            result = tecnicofs_lookup(path_1);
+            break;
+        case OP_MOVE:
+            result = tecnicofs_move(path_1, path_2);
+            break;
+        case OP_PRINT:
+            result = tecnicofs_print(path_1);
+            break;
+        case OP_PRINT_CHANGES: {
+            int64_t seq = 0;
+            result = tecnicofs_print_changes(path_1, arg, &seq);
+            session->changes_seq = seq;
+            break;
+        }
+        default:
+            result = TECNICOFS_ERROR_OTHER;
+    }
+
+    if (session->timeout_ms > 0) tecnicofs_set_deadline(NULL);
+    return result;
+}
+
+
+/*
+ * Runs the operations of the batch collected by an embedded session, in order.
+ *
+ * Input:
+ *   - session: embedded session
+ *   - results: array where the result of each operation is written, in order
+ * Output:
+ *   - number of operations in the batch
+ * */
+int embedded_batch(tfs_session *session, int *results) {
+    char *next = session->batch + TFS_ALIGN((int) sizeof(tfs_request_header));
+
+    /* the batch was encoded by batch_append, so every request in it is well formed */
+    for (int i = 0; i < session->batch_count; i++) {
+        tfs_request_header header;
+        memcpy(&header, next, sizeof(header));
+
+        char *path_1 = header.path_size[0] > 0 ? next + sizeof(header) : NULL;
+        char *path_2 = header.path_size[1] > 0 ? next + sizeof(header) + header.path_size[0] : NULL;
+
+        results[i] = embedded_execute(session, header.opcode, header.flags, header.arg, path_1, path_2);
+        next += TFS_ALIGN((int) sizeof(header) + header.path_size[0] + header.path_size[1]);
+    }
+
+    return session->batch_count;
+}
+
+
+/*
+ * Dump function that gathers the dump of an embedded session.
+ *
+ * Input:
+ *   - ptr: embedded session
+ *   - bytes: piece of the dump
+ *   - size: number of bytes
+ * Output:
+ *   - 0
+ * */
+int embedded_dump(void *ptr, const char *bytes, size_t size) {
+    tfs_session *session = ptr;
+
+    if (session->dump_size + size > session->dump_capacity) {
+        size_t needed = session->dump_size + size;
+        session->dump_capacity = needed > 2 * session->dump_capacity ? needed : 2 * session->dump_capacity;
+        session->dump = realloc(session->dump, session->dump_capacity);
+        assert__(session->dump != NULL, "Error: tfsDumpBegin couldn't allocate dump!\n")
+    }
+    memcpy(session->dump + session->dump_size, bytes, size);
+    session->dump_size += size;
+
+    return 0;
+}
+
+
+/*
+ * Sends a request to the tecnicofs server and waits for its response. While a batch is open,
+ * the request is added to it instead.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - opcode: OP_* code of the operation
+ *   - flags: TFS_FLAG_* flags
+ *   - arg: numeric argument of the operation
+ *   - path_1, path_2: paths of the operation (NULL if unused)
+ * Output:
+ *   - status sent by the server, position in the batch or TECNICOFS_ERROR_* code
+ * */
+int send_request(tfs_session *session, uint8_t opcode, uint16_t flags, int64_t arg, char *path_1, char *path_2) {
+
+    if (session->batch_open) return batch_append(session, opcode, flags, arg, path_1, path_2);
+    if (session->embedded) return embedded_execute(session, opcode, flags, arg, path_1, path_2);
+
+    uint32_t id = next_request_id(session);
+    int size = encode_request(session->request, opcode, flags, id, arg, request_deadline(session), path_1, path_2);
+    if (size < 0) return TECNICOFS_ERROR_OTHER;
+
+    /* send message to the server */
+    if (! send_message(session, session->request, size)) return receive_error(session);
 
     /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+    if (! receive_response(session, id)) return receive_error(session);
+
+    return session->response.header.status;
+}
+
+
+/*
+ * Sends a request to the tecnicofs server without waiting for its response.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - opcode: OP_* code of the operation
+ *   - flags: TFS_FLAG_* flags
+ *   - arg: numeric argument of the operation
+ *   - path_1, path_2: paths of the operation (NULL if unused)
+ * Output:
+ *   - ticket for tfsWait or TECNICOFS_ERROR_* code
+ * */
+int send_async(tfs_session *session, uint8_t opcode, uint16_t flags, int64_t arg, char *path_1, char *path_2) {
+
+    /* a batch only sends its operations when submitted, so they can't be waited on alone */
+    if (session->batch_open || session->in_flight_count == TFS_MAX_IN_FLIGHT) return TECNICOFS_ERROR_OTHER;
+
+    uint32_t id = next_request_id(session);
+    in_flight *slot = in_flight_find(session, 0);
+
+    /* embedded operations are done right away; their ticket just holds the result */
+    if (session->embedded) {
+        slot->id = id;
+        slot->done = 1;
+        slot->status = embedded_execute(session, opcode, flags, arg, path_1, path_2);
+        session->in_flight_count++;
+        return (int) id;
+    }
+
+    int size = encode_request(session->request, opcode, flags, id, arg, request_deadline(session), path_1, path_2);
+    if (size < 0) return TECNICOFS_ERROR_OTHER;
+
+    /* send message to the server */
+    if (! send_message(session, session->request, size)) return TECNICOFS_ERROR_CONNECTION_ERROR;
+
+    slot->id = id;
+    slot->done = 0;
+    session->in_flight_count++;
+    session->in_flight_waiting++;
 
-    return output[0];
+    return (int) id;
 }
 
 
 /*
- * Creates and allocates all the resources needed for client socket. Also registers server socket.
+ * Moves a session to shared memory: creates a region, passes it to the server and, if the
+ * server attaches it, sends every request after this one through it. Servers started without
+ * shared memory sessions refuse, and the session stays on its socket.
  *
  * Input:
+ *   - session: session just opened
+ * */
+void shm_attach(tfs_session *session) {
+
+    /* the region is sealed at its size, so the server can trust it to stay mapped */
+    int fd = memfd_create("tecnicofs-session", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) return;
+
+    tfs_shm_region *region = MAP_FAILED;
+    if (ftruncate(fd, sizeof(tfs_shm_region)) == 0 && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0)
+        region = mmap(NULL, sizeof(tfs_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    region->version = TFS_SHM_VERSION;
+    region->client_pid = getpid();
+
+    uint32_t id = next_request_id(session);
+    int size = encode_request(session->request, OP_SHM_ATTACH, 0, id, 0, 0, NULL, NULL);
+
+    /* the descriptor goes along with the request as SCM_RIGHTS */
+    union {
+        struct cmsghdr align;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { session->request, size };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = session->connected ? NULL : &session->server_socket;
+    msg.msg_namelen = session->connected ? 0 : session->serv_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = sizeof(control.bytes);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    int attached = sendmsg(session->client_fd, &msg, MSG_NOSIGNAL) >= 0 && receive_response(session, id)
+                   && session->response.header.status == 0;
+    close(fd);
+
+    if (! attached) {
+        munmap(region, sizeof(tfs_shm_region));
+        return;
+    }
+
+    session->shm = region;
+    session->shm_spin = tfs_shm_spin_start();
+}
+
+
+/*
+ * Maps the namespace mirror published by the server, if there is one.
+ *
+ * Input:
+ *   - session: session just opened
  *   - server_socket_path: path to server socket
+ * */
+void ns_map(tfs_session *session, char *server_socket_path) {
+
+    char path[strlen(server_socket_path) + sizeof(TFS_NS_SUFFIX)];
+    sprintf(path, "%s%s", server_socket_path, TFS_NS_SUFFIX);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    tfs_ns_region header;
+    tfs_ns_region *region = MAP_FAILED;
+    size_t size = 0;
+
+    /* the size comes from the header, which is only trusted once the version is there */
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.version == TFS_NS_VERSION
+            && header.inodes > 0 && header.entries > 0) {
+        size = tfs_ns_size(header.inodes, header.entries);
+        region = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (region == MAP_FAILED) return;
+    if (__atomic_load_n(&region->closed, __ATOMIC_ACQUIRE)) {
+        munmap(region, size);
+        return;
+    }
+
+    session->ns = region;
+    session->ns_size = size;
+}
+
+
+/*
+ * Walks a path in the namespace mirror, the same way the server does. The mirror may change
+ * under the walk, so nothing read is trusted: the caller validates the result afterwards.
+ *
+ * Input:
+ *   - region: namespace mirror
+ *   - path: copy of the path, cut into its names
  * Output:
- *   - EXIT_SUCCESS or error
+ *   - inumber of the file/directory or TECNICOFS_ERROR_FILE_NOT_FOUND
  * */
-int tfsMount(char* server_socket_path) {
+int ns_walk(tfs_ns_region *region, char *path) {
+    char *save_ptr;
+    int inumber = 0;  /* root */
+    tfs_ns_inode *inode = tfs_ns_inode_at(region, inumber);
+
+    if (inode->node_type == T_NONE) return TECNICOFS_ERROR_FILE_NOT_FOUND;
+
+    for (char *name = strtok_r(path, "/", &save_ptr); name != NULL; name = strtok_r(NULL, "/", &save_ptr)) {
+        if (inode->node_type != T_DIRECTORY || strlen(name) >= MAX_FILE_NAME) return TECNICOFS_ERROR_FILE_NOT_FOUND;
+
+        int next = -1;
+        for (int i = 0; i < region->entries && next == -1; i++) {
+            int sub = inode->entries[i].inumber;
+            if (sub >= 0 && sub < region->inodes && strncmp(inode->entries[i].name, name, MAX_FILE_NAME) == 0)
+                next = sub;
+        }
+
+        if (next == -1) return TECNICOFS_ERROR_FILE_NOT_FOUND;
+        inumber = next;
+        inode = tfs_ns_inode_at(region, inumber);
+        if (inode->node_type == T_NONE) return TECNICOFS_ERROR_FILE_NOT_FOUND;
+    }
+    return inumber;
+}
 
-    int sock_fd;  /* client socket file descriptor */
 
-    /*Max Number threads is around 2^22*/
-    char pid[7];
+/*
+ * Looks a path up in the namespace mirror, without asking the server. The walk is retried
+ * while the server keeps changing the mirror under it.
+ *
+ * Input:
+ *   - session: session with a namespace mirror
+ *   - path: file/directory that is going to be searched
+ *   - result: gets the inumber of the file/directory or TECNICOFS_ERROR_FILE_NOT_FOUND
+ * Output:
+ *   - 1 if the result can be trusted, 0 if the server must be asked
+ * */
+int ns_lookup(tfs_session *session, char *path, int *result) {
+    tfs_ns_region *region = session->ns;
+    char copy[MAX_PATH_SIZE];
 
-    /* sets client socket path as: /tmp/<pid> */
-    sprintf(pid, "%d", getpid());
-    strcat(client_path, pid);
+    if (strlen(path) >= MAX_PATH_SIZE) return 0;
+
+    for (int attempt = 0; attempt < TFS_NS_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&region->seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&region->closed, __ATOMIC_RELAXED)) return 0;
+        if (seq & 1) continue;  /* the server is writing */
+
+        strcpy(copy, path);
+        *result = ns_walk(region, copy);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&region->seq, __ATOMIC_RELAXED) == seq) return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Opens a session with the tecnicofs server. A server started in seqpacket mode gets a
+ * connection of its own; otherwise the session binds a datagram socket of its own, at
+ * /tmp/<pid>-<n>, and registers the server socket. Either way, the session then moves to
+ * shared memory if the server allows it. Without a server, the session runs the engine in this
+ * process instead.
+ *
+ * Input:
+ *   - server_socket_path: path to server socket, or NULL for an embedded session
+ * Output:
+ *   - session or NULL if it couldn't be opened
+ * */
+tfs_session *tfsSessionOpen(char *server_socket_path) {
+
+    if (server_socket_path == NULL) {
+        tfs_session *session = calloc(1, sizeof(tfs_session));
+        if (session == NULL) return NULL;
+
+        session->embedded = 1;
+        tecnicofs_init();
+        return session;
+    }
+
+    if (strlen(server_socket_path) >= sizeof(((struct sockaddr_un *) NULL)->sun_path)) return NULL;
+
+    tfs_session *session = calloc(1, sizeof(tfs_session));
+    if (session == NULL) return NULL;
 
     /* gets server socket so that it can be used by other functions */
-    strcpy(server_socket.sun_path, server_socket_path);
-    server_socket.sun_family = AF_UNIX;
+    session->serv_len = set_socket_address_unix(server_socket_path, &session->server_socket);
+
+    /* connecting fails with EPROTOTYPE when the server listens on a datagram socket instead */
+    if ((session->client_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) != -1) {
+        if (connect(session->client_fd, (struct sockaddr *) &session->server_socket, session->serv_len) == 0) {
+            session->connected = 1;
+            ns_map(session, server_socket_path);
+            shm_attach(session);
+            return session;
+        }
+        close(session->client_fd);
+    }
+
+    /* sets client socket path as: /tmp/<pid>-<n>, with n unique inside the process */
+    int number = __atomic_add_fetch(&session_count, 1, __ATOMIC_RELAXED);
+    sprintf(session->client_path, "/tmp/%d-%d", getpid(), number);
 
     struct sockaddr_un client_addr;  /* client socket address */
     socklen_t addrlen;  /* size of client socket */
 
     /* creates client side socket */
-    assert__((sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) != -1, "Error: couldn't create client socket!\n")
+    if ((session->client_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+        free(session);
+        return NULL;
+    }
 
     /* removes possible previous links */
-    unlink(client_path);
+    unlink(session->client_path);
 
     /* gets socket size and initializes values */
-    addrlen = set_socket_address_unix(client_path, &client_addr);
+    addrlen = set_socket_address_unix(session->client_path, &client_addr);
 
     /* assigns a local socket address to a socket identified by descriptor socket */
-    assert__(bind(sock_fd, (struct sockaddr *) &client_addr, addrlen) != -1, "Error: couldn't bind client socket!\n")
-
-    client_fd = sock_fd;  /* saves file descriptor so that all functions can access it */
-
-    return EXIT_SUCCESS;
+    if (bind(session->client_fd, (struct sockaddr *) &client_addr, addrlen) == -1) {
+        close(session->client_fd);
+        free(session);
+        return NULL;
+    }
+
+    ns_map(session, server_socket_path);
+    shm_attach(session);
+    return session;
 }
 
 
 /*
- * Clears previously allocated resources for the client socket
+ * Closes a session, clearing its socket and freeing it.
  *
+ * Input:
+ *   - session: session opened by tfsSessionOpen
  * Output:
- *   - EXIT_SUCCESS or error
+ *   - EXIT_SUCCESS or EXIT_FAILURE
  * */
-int tfsUnmount() {
+int tfsSessionClose(tfs_session *session) {
+
+    if (session->embedded) {
+        free(session->dump);
+        free(session->stream_path);
+        free(session);
+        return EXIT_SUCCESS;
+    }
+
+    /* the server's thread for the region sees it closed and lets it go */
+    if (session->shm != NULL) {
+        __atomic_store_n(&session->shm->closed, 1, __ATOMIC_RELEASE);
+        tfs_shm_ring_bell(&session->shm->server_bell);
+        munmap(session->shm, sizeof(tfs_shm_region));
+    }
+    if (session->ns != NULL) munmap(session->ns, session->ns_size);
 
     /* clears previously allocated link */
-    unlink(client_path);
+    if (! session->connected) unlink(session->client_path);
 
     /* shuts down, closes and frees resources associated with the client socket */
-    assert__(shutdown(client_fd, SHUT_RDWR) == 0, "Error: tfsMount couldn't shutdown socket!\n")
-    assert__(close(client_fd) == 0, "Error: tfsMount couldn't close socket!\n")
+    int status = shutdown(session->client_fd, SHUT_RDWR) == 0 && close(session->client_fd) == 0;
+
+    free(session->stream_path);
+    free(session);
+
+    return status ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to create a file/directory.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - filename: file/directory path that is going to be created
+ *   - nodeType: f, creates a file and d, creates a directory
+ * Output:
+ *   - SUCCESS or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionCreate(tfs_session *session, char *filename, char nodeType) {
+    return send_request(session, OP_CREATE, nodeType == 'd' ? TFS_FLAG_DIRECTORY : 0, 0, filename, NULL);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to delete a file/directory.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - path: file path that is going to be deleted
+ * Output:
+ *   - SUCCESS or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionDelete(tfs_session *session, char *path) {
+    return send_request(session, OP_DELETE, 0, 0, path, NULL);
+}
+
 
+/*
+ * Sends message to tecnicofs server telling it to move a file/directory.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - from: file/directory that is going to be moved
+ *   - to: new path for the input file/directory
+ * Output:
+ *   - SUCCESS or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionMove(tfs_session *session, char *from, char *to) {
+    return send_request(session, OP_MOVE, 0, 0, from, to);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to lookup a file/directory. Servers that publish
+ * their namespace aren't asked at all, unless they are changing it too fast for the lookup.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - path: file/directory that is going to be searched
+ * Output:
+ *   - inumber of the file/directory or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionLookup(tfs_session *session, char *path) {
+    int result;
+
+    /* lookups added to a batch must still run in order with the other operations */
+    if (session->ns != NULL && ! session->batch_open && ns_lookup(session, path, &result)) return result;
+
+    return send_request(session, OP_LOOKUP, 0, 0, path, NULL);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to print it's tree.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - out_file: file where the contents will be written
+ * Output:
+ *   - SUCCESS or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionPrint(tfs_session *session, char* out_file) {
+    return send_request(session, OP_PRINT, 0, 0, out_file, NULL);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to print the changes made since an earlier call.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - out_file: file where the changes will be written
+ *   - since: sequence number of an earlier call, or a negative number to print the whole tree
+ *   - seq: gets the sequence number to use in the next call. not written when the call is added
+ *          to a batch, whose results only hold statuses
+ * Output:
+ *   - 0, position in the batch or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionPrintChanges(tfs_session *session, char* out_file, int64_t since, int64_t *seq) {
+
+    int batched = session->batch_open;
+    int res = send_request(session, OP_PRINT_CHANGES, 0, since, out_file, NULL);
+    if (batched || res != 0) return res;
+
+    if (session->embedded) {
+        *seq = session->changes_seq;
+        return 0;
+    }
+
+    if (session->response.header.size != sizeof(int64_t)) return TECNICOFS_ERROR_OTHER;
+    memcpy(seq, session->response.bytes + sizeof(tfs_response_header), sizeof(int64_t));
+    return 0;
+}
+
+
+/*
+ * Asynchronous versions of tfsSessionCreate, tfsSessionDelete, tfsSessionMove and
+ * tfsSessionLookup. They return as soon as the request is sent, so many requests can be in
+ * flight at once and be answered out of order by the server's threads.
+ *
+ * Output:
+ *   - ticket for tfsSessionWait or TECNICOFS_ERROR_* code (TECNICOFS_ERROR_OTHER if
+ *     TFS_MAX_IN_FLIGHT requests are already in flight)
+ * */
+int tfsSessionCreateAsync(tfs_session *session, char *filename, char nodeType) {
+    return send_async(session, OP_CREATE, nodeType == 'd' ? TFS_FLAG_DIRECTORY : 0, 0, filename, NULL);
+}
+
+int tfsSessionDeleteAsync(tfs_session *session, char *path) {
+    return send_async(session, OP_DELETE, 0, 0, path, NULL);
+}
+
+int tfsSessionMoveAsync(tfs_session *session, char *from, char *to) {
+    return send_async(session, OP_MOVE, 0, 0, from, to);
+}
+
+int tfsSessionLookupAsync(tfs_session *session, char *path) {
+    return send_async(session, OP_LOOKUP, 0, 0, path, NULL);
+}
+
+
+/*
+ * Waits for the response to an asynchronous request. Each ticket can only be waited on once.
+ *
+ * Input:
+ *   - session: session that sent the request
+ *   - ticket: value returned by a tfs*Async call
+ * Output:
+ *   - what the synchronous call would have returned or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionWait(tfs_session *session, int ticket) {
+
+    in_flight *slot = ticket > 0 ? in_flight_find(session, (uint32_t) ticket) : NULL;
+    if (slot == NULL) return TECNICOFS_ERROR_OTHER;
+
+    if (! slot->done) {
+        slot->status = receive_response(session, slot->id) ? session->response.header.status : receive_error(session);
+        session->in_flight_waiting--;
+    }
+
+    slot->id = 0;
+    session->in_flight_count--;
+
+    return slot->status;
+}
+
+
+/*
+ * Starts collecting a batch. Until tfsSessionBatchSubmit is called, the create, delete, move,
+ * lookup, print and print changes calls only add their operation to the batch and return its
+ * position in it, or TECNICOFS_ERROR_OTHER once the batch is full.
+ *
+ * Input:
+ *   - session: session collecting the batch
+ * Output:
+ *   - 0
+ * */
+int tfsSessionBatchBegin(tfs_session *session) {
+    session->batch_open = 1;
+    session->batch_count = 0;
+    session->batch_size = TFS_ALIGN((int) sizeof(tfs_request_header));
+    return 0;
+}
+
+
+/*
+ * Sends the batch collected since tfsSessionBatchBegin in a single message. The server runs its
+ * operations in order and answers with the result of each one.
+ *
+ * Input:
+ *   - session: session collecting the batch
+ *   - results: array where the result of each operation is written, in order
+ * Output:
+ *   - number of operations in the batch or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionBatchSubmit(tfs_session *session, int *results) {
+
+    session->batch_open = 0;
+    if (session->batch_count == 0) return 0;
+    if (session->embedded) return embedded_batch(session, results);
+
+    uint32_t id = next_request_id(session);
+    tfs_request_header header = { TFS_PROTOCOL_VERSION, OP_BATCH, 0, id, session->batch_count, { 0, 0 }, request_deadline(session) };
+    memcpy(session->batch, &header, sizeof(header));
+
+    /* send message to the server */
+    if (! send_message(session, session->batch, session->batch_size)) return receive_error(session);
+
+    /* gets message from the server */
+    if (! receive_response(session, id)) return receive_error(session);
+    if (session->response.header.status != 0) return session->response.header.status;
+    if (session->response.header.size != session->batch_count * sizeof(int32_t)) return TECNICOFS_ERROR_OTHER;
+
+    int32_t *statuses = (int32_t *) (session->response.bytes + sizeof(tfs_response_header));
+    for (int i = 0; i < session->batch_count; i++) results[i] = statuses[i];
+
+    return session->batch_count;
+}
+
+
+/*
+ * Asks the tecnicofs server to stream its tree back to this session. Paths are then read one
+ * by one with tfsSessionDumpNext, as they arrive, and tfsSessionDumpEnd must be called once
+ * done.
+ *
+ * Input:
+ *   - session: session receiving the stream
+ * Output:
+ *   - 0 or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionDumpBegin(tfs_session *session) {
+
+    session->stream_left = 0;
+    session->stream_more = 0;
+    session->stream_id = next_request_id(session);
+
+    /* the engine dumps into memory, which is then read as a single message */
+    if (session->embedded) {
+        session->dump_size = 0;
+        session->stream_status = tecnicofs_dump(embedded_dump, session) == 0 ? 0 : TECNICOFS_ERROR_OTHER;
+        session->stream_pos = session->dump;
+        session->stream_left = session->stream_status == 0 ? (int) session->dump_size : 0;
+        return session->stream_status;
+    }
+
+    int size = encode_request(session->request, OP_STREAM, 0, session->stream_id, 0, request_deadline(session), NULL, NULL);
+
+    /* send message to stream */
+    if (! send_message(session, session->request, size)) {
+        session->stream_status = TECNICOFS_ERROR_CONNECTION_ERROR;
+        return session->stream_status;
+    }
+
+    session->stream_more = 1;
+    session->stream_status = 0;
+
+    return 0;
+}
+
+
+/*
+ * Receives the next message of the current stream.
+ *
+ * Input:
+ *   - session: session receiving the stream
+ * Output:
+ *   - 1 if a message was received, 0 if the stream is over
+ * */
+int stream_receive(tfs_session *session) {
+
+    if (! session->stream_more) return 0;
+
+    if (! receive_response(session, session->stream_id)) {
+        session->stream_more = 0;
+        session->stream_status = receive_error(session);
+        return 0;
+    }
+
+    session->stream_more = session->response.header.flags & TFS_FLAG_MORE;
+    session->stream_status = session->response.header.status;
+    session->stream_pos = session->response.bytes + sizeof(tfs_response_header);
+    session->stream_left = session->response.header.size;
+
+    return 1;
+}
+
+
+/*
+ * Gets the next path of the tree streamed by the server, waiting for it if needed.
+ *
+ * Input:
+ *   - session: session receiving the stream
+ * Output:
+ *   - path (valid until the next call) or NULL if the stream is over
+ * */
+char *tfsSessionDumpNext(tfs_session *session) {
+    int size = 0;
+
+    while (1) {
+        if (session->stream_left == 0 && ! stream_receive(session)) {
+            /* the last line of the dump always ends in '\n', so nothing is left behind here */
+            return NULL;
+        }
+
+        char *end = memchr(session->stream_pos, '\n', session->stream_left);
+        int length = end ? (int) (end - session->stream_pos) : session->stream_left;
+
+        /* lines can be split between messages, so they are gathered in stream_path */
+        if (size + length + 1 > session->stream_path_size) {
+            int needed = size + length + 1;
+            session->stream_path_size = needed > 2 * session->stream_path_size ? needed : 2 * session->stream_path_size;
+            session->stream_path = realloc(session->stream_path, session->stream_path_size);
+            assert__(session->stream_path != NULL, "Error: tfsDumpNext couldn't allocate path!\n")
+        }
+        memcpy(session->stream_path + size, session->stream_pos, length);
+        size += length;
+
+        session->stream_pos += length;
+        session->stream_left -= length;
+
+        if (end != NULL) {
+            session->stream_pos++;
+            session->stream_left--;
+            session->stream_path[size] = '\0';
+            return session->stream_path;
+        }
+    }
+}
+
+
+/*
+ * Finishes the current stream, discarding the paths that weren't read.
+ *
+ * Input:
+ *   - session: session receiving the stream
+ * Output:
+ *   - 0 or the error reported by the server
+ * */
+int tfsSessionDumpEnd(tfs_session *session) {
+    while (stream_receive(session)) {}
+    session->stream_left = 0;
+    return session->stream_status;
+}
+
+
+/*
+ * Sets how long the calls of a session wait for their responses. The deadline is sent with
+ * each request, so the server drops it unanswered if it only gets to it later, and calls that
+ * give up return TECNICOFS_ERROR_TIMEOUT. A response that arrives after that is discarded.
+ *
+ * Input:
+ *   - session: session to set
+ *   - timeout_ms: milliseconds to wait, or 0 to wait forever
+ * Output:
+ *   - 0 or TECNICOFS_ERROR_OTHER if the timeout is negative or the socket refused it
+ * */
+int tfsSessionSetTimeout(tfs_session *session, int timeout_ms) {
+
+    if (timeout_ms < 0) return TECNICOFS_ERROR_OTHER;
+
+    /* each wait for a message on the socket ends at the timeout at most */
+    if (! session->embedded) {
+        struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        if (setsockopt(session->client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+            return TECNICOFS_ERROR_OTHER;
+    }
+
+    session->timeout_ms = timeout_ms;
+    return 0;
+}
+
+
+/*
+ * Asks the server how its threads are split and how full its queues are.
+ *
+ * Input:
+ *   - session: session sending the request
+ *   - stats: gets the counters of the server
+ * Output:
+ *   - 0 or TECNICOFS_ERROR_* code
+ * */
+int tfsSessionStats(tfs_session *session, tfs_stats *stats) {
+
+    /* an embedded engine has no queues and a batch only holds file system operations */
+    if (session->embedded || session->batch_open) return TECNICOFS_ERROR_OTHER;
+
+    int id = next_request_id(session);
+    int size = encode_request(session->request, OP_STATS, 0, id, 0, request_deadline(session), NULL, NULL);
+
+    if (! send_message(session, session->request, size) || ! receive_response(session, id))
+        return receive_error(session);
+
+    if (session->response.header.status != 0) return session->response.header.status;
+    if (session->response.header.size != sizeof(tfs_stats)) return TECNICOFS_ERROR_OTHER;
+
+    memcpy(stats, session->response.bytes + sizeof(tfs_response_header), sizeof(tfs_stats));
+    return 0;
+}
+
+
+/*
+ * Calls without a session work on the one opened by tfsMount. They behave as their tfsSession*
+ * counterparts.
+ * */
+
+int tfsCreate(char *filename, char nodeType) {
+    return tfsSessionCreate(default_session, filename, nodeType);
+}
+
+int tfsDelete(char *path) {
+    return tfsSessionDelete(default_session, path);
+}
+
+int tfsMove(char *from, char *to) {
+    return tfsSessionMove(default_session, from, to);
+}
+
+int tfsLookup(char *path) {
+    return tfsSessionLookup(default_session, path);
+}
+
+int tfsPrint(char* out_file) {
+    return tfsSessionPrint(default_session, out_file);
+}
+
+int tfsPrintChanges(char* out_file, int64_t since, int64_t *seq) {
+    return tfsSessionPrintChanges(default_session, out_file, since, seq);
+}
+
+int tfsCreateAsync(char *filename, char nodeType) {
+    return tfsSessionCreateAsync(default_session, filename, nodeType);
+}
+
+int tfsDeleteAsync(char *path) {
+    return tfsSessionDeleteAsync(default_session, path);
+}
+
+int tfsMoveAsync(char *from, char *to) {
+    return tfsSessionMoveAsync(default_session, from, to);
+}
+
+int tfsLookupAsync(char *path) {
+    return tfsSessionLookupAsync(default_session, path);
+}
+
+int tfsWait(int ticket) {
+    return tfsSessionWait(default_session, ticket);
+}
+
+int tfsBatchBegin() {
+    return tfsSessionBatchBegin(default_session);
+}
+
+int tfsBatchSubmit(int *results) {
+    return tfsSessionBatchSubmit(default_session, results);
+}
+
+int tfsDumpBegin() {
+    return tfsSessionDumpBegin(default_session);
+}
+
+char *tfsDumpNext() {
+    return tfsSessionDumpNext(default_session);
+}
+
+int tfsDumpEnd() {
+    return tfsSessionDumpEnd(default_session);
+}
+
+int tfsStats(tfs_stats *stats) {
+    return tfsSessionStats(default_session, stats);
+}
+
+int tfsSetTimeout(int timeout_ms) {
+    return tfsSessionSetTimeout(default_session, timeout_ms);
+}
+
+
+/*
+ * Opens the session used by the calls that don't take one.
+ *
+ * Input:
+ *   - server_socket_path: path to server socket, or NULL to run the engine in this process
+ * Output:
+ *   - EXIT_SUCCESS or error
+ * */
+int tfsMount(char* server_socket_path) {
+    assert__((default_session = tfsSessionOpen(server_socket_path)) != NULL, "Error: couldn't create client socket!\n")
+    return EXIT_SUCCESS;
+}
+
+
+/*
+ * Closes the session opened by tfsMount.
+ *
+ * Output:
+ *   - EXIT_SUCCESS or error
+ * */
+int tfsUnmount() {
+    assert__(tfsSessionClose(default_session) == EXIT_SUCCESS, "Error: tfsMount couldn't close socket!\n")
+    default_session = NULL;
     return EXIT_SUCCESS;
 }
@@ -2,12 +2,51 @@
 #define API_H
 
 #include "../tecnicofs-api-constants.h"
+#include "../tecnicofs-protocol.h"
 
+/* connection to the server with its own socket and buffers; one per thread */
+typedef struct tfs_session tfs_session;
+
+tfs_session *tfsSessionOpen(char *server_socket_path);
+int tfsSessionClose(tfs_session *session);
+int tfsSessionCreate(tfs_session *session, char *filename, char nodeType);
+int tfsSessionDelete(tfs_session *session, char *path);
+int tfsSessionLookup(tfs_session *session, char *path);
+int tfsSessionMove(tfs_session *session, char *from, char *to);
+int tfsSessionPrint(tfs_session *session, char *out_file);
+int tfsSessionPrintChanges(tfs_session *session, char *out_file, int64_t since, int64_t *seq);
+int tfsSessionCreateAsync(tfs_session *session, char *filename, char nodeType);
+int tfsSessionDeleteAsync(tfs_session *session, char *path);
+int tfsSessionMoveAsync(tfs_session *session, char *from, char *to);
+int tfsSessionLookupAsync(tfs_session *session, char *path);
+int tfsSessionWait(tfs_session *session, int ticket);
+int tfsSessionBatchBegin(tfs_session *session);
+int tfsSessionBatchSubmit(tfs_session *session, int *results);
+int tfsSessionDumpBegin(tfs_session *session);
+char *tfsSessionDumpNext(tfs_session *session);
+int tfsSessionDumpEnd(tfs_session *session);
+int tfsSessionStats(tfs_session *session, tfs_stats *stats);
+int tfsSessionSetTimeout(tfs_session *session, int timeout_ms);
+
+/* same calls on the session opened by tfsMount */
 int tfsCreate(char *filename, char nodeType);
 int tfsDelete(char* path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
 int tfsPrint(char* out_file);
+int tfsPrintChanges(char* out_file, int64_t since, int64_t *seq);
+int tfsCreateAsync(char *filename, char nodeType);
+int tfsDeleteAsync(char *path);
+int tfsMoveAsync(char *from, char *to);
+int tfsLookupAsync(char *path);
+int tfsWait(int ticket);
+int tfsBatchBegin();
+int tfsBatchSubmit(int *results);
+int tfsDumpBegin();
+char *tfsDumpNext();
+int tfsDumpEnd();
+int tfsStats(tfs_stats *stats);
+int tfsSetTimeout(int timeout_ms);
 int tfsMount(char* line);
 int tfsUnmount();
 
@@ -1,17 +1,32 @@
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "tecnicofs-client-api.h"
 #include "../tecnicofs-api-constants.h"
+#include "../tecnicofs-protocol.h"
+
+/* bounds of the wait before sending again a batch the server was too busy to take, in
+ * microseconds. it doubles each time the server is still busy */
+#define BUSY_BACKOFF_MIN 1000
+#define BUSY_BACKOFF_MAX 100000
 
 /* File with commands that are going to be executed */
 FILE* inputFile;
 
-/* Server socket path */
+/* Server socket path (NULL runs the file system inside the client) */
 char* serverName;
 
+/* Sequence number of the last print of changes (negative before the first one) */
+int64_t lastChanges = -1;
+
+/* how commands are sent: 'b' in batches, 'a' as asynchronous requests, 'o' one call at a time */
+char sendMode = 'b';
+
 
 static void displayUsage (const char* appName) {
-    printf("Usage: %s inputfile server_socket_name\n", appName);
+    printf("Usage: %s inputfile server_socket_name|-\n", appName);
     exit(EXIT_FAILURE);
 }
 
@@ -22,7 +37,8 @@ static void parseArgs (long argc, char* const argv[]) {
         displayUsage(argv[0]);
     }
 
-    serverName = argv[2];
+    /* "-" asks for an embedded session instead of a server */
+    serverName = strcmp(argv[2], "-") == 0 ? NULL : argv[2];
 
     inputFile = fopen(argv[1], "r");
 
@@ -33,89 +49,300 @@ static void parseArgs (long argc, char* const argv[]) {
 }
 
 
+/* Command read from the input file, waiting to be sent in a batch */
+typedef struct command {
+    char op;
+    char arg1[MAX_PATH_SIZE], arg2[MAX_PATH_SIZE];
+} command;
+
+/* Commands read since the last batch was sent */
+command pending[TFS_MAX_BATCH];
+int numPending = 0;
+
+
+/*
+ * Reports the result of a command.
+ *
+ * Input:
+ *   - cmd: command that was executed
+ *   - res: value returned by the server for it
+ * */
+void printResult(command *cmd, int res) {
+    switch (cmd->op) {
+        case 'c':
+            if (cmd->arg2[0] == 'f') {
+                if (!res)
+                  printf("Created file: %s\n", cmd->arg1);
+                else
+                  printf("Unable to create file: %s\n", cmd->arg1);
+            } else {
+                if (!res)
+                  printf("Created directory: %s\n", cmd->arg1);
+                else
+                  printf("Unable to create directory: %s\n", cmd->arg1);
+            }
+            break;
+
+        case 'l':
+            if (res >= 0)
+                printf("Search: %s found\n", cmd->arg1);
+            else
+                printf("Search: %s not found\n", cmd->arg1);
+            break;
+
+        case 'd':
+            if (!res)
+              printf("Deleted: %s\n", cmd->arg1);
+            else
+              printf("Unable to delete: %s\n", cmd->arg1);
+            break;
+
+        case 'm':
+            if (!res)
+              printf("Moved: %s to %s\n", cmd->arg1, cmd->arg2);
+            else
+              printf("Unable to move: %s to %s\n", cmd->arg1, cmd->arg2);
+            break;
+    }
+}
+
+
+/*
+ * Adds a command to the open batch, or runs it right away if there is none.
+ *
+ * Input:
+ *   - cmd: command that is going to be executed
+ * Output:
+ *   - position of the command in the batch or TECNICOFS_ERROR_OTHER if it doesn't fit. without
+ *     a batch, the result of the command
+ * */
+int queueCommand(command *cmd) {
+    switch (cmd->op) {
+        case 'c': return tfsCreate(cmd->arg1, cmd->arg2[0]);
+        case 'l': return tfsLookup(cmd->arg1);
+        case 'd': return tfsDelete(cmd->arg1);
+        default: return tfsMove(cmd->arg1, cmd->arg2);
+    }
+}
+
+
+/*
+ * Sends the pending commands one synchronous call at a time, so lookups can be resolved in the
+ * namespace mirror, and reports their results.
+ * */
+void flushSingleCommands() {
+    for (int i = 0; i < numPending; i++) {
+        int res = queueCommand(&pending[i]);
+        int backoff = BUSY_BACKOFF_MIN;
+
+        /* a request the server was too busy to take is sent again after a while */
+        while (res == TECNICOFS_ERROR_BUSY) {
+            usleep(backoff);
+            if (backoff < BUSY_BACKOFF_MAX) backoff *= 2;
+            res = queueCommand(&pending[i]);
+        }
+        printResult(&pending[i], res);
+    }
+
+    numPending = 0;
+}
+
+
+/*
+ * Sends a command as an asynchronous request.
+ *
+ * Input:
+ *   - cmd: command that is going to be executed
+ * Output:
+ *   - ticket of the request or TECNICOFS_ERROR_* code
+ * */
+int sendCommand(command *cmd) {
+    switch (cmd->op) {
+        case 'c': return tfsCreateAsync(cmd->arg1, cmd->arg2[0]);
+        case 'l': return tfsLookupAsync(cmd->arg1);
+        case 'd': return tfsDeleteAsync(cmd->arg1);
+        default: return tfsMoveAsync(cmd->arg1, cmd->arg2);
+    }
+}
+
+
+/*
+ * Sends the pending commands as asynchronous requests, up to TFS_MAX_IN_FLIGHT at a time, and
+ * reports their results in the order they were read. Requests in flight together may run in
+ * any order, so the commands between two flushes shouldn't depend on each other.
+ * */
+void flushAsyncCommands() {
+    int tickets[TFS_MAX_IN_FLIGHT];
+
+    for (int first = 0; first < numPending; first += TFS_MAX_IN_FLIGHT) {
+        int last = first + TFS_MAX_IN_FLIGHT < numPending ? first + TFS_MAX_IN_FLIGHT : numPending;
+
+        for (int i = first; i < last; i++) tickets[i - first] = sendCommand(&pending[i]);
+
+        for (int i = first; i < last; i++) {
+            int ticket = tickets[i - first];
+            int res = ticket < 0 ? ticket : tfsWait(ticket);
+            int backoff = BUSY_BACKOFF_MIN;
+
+            /* a request the server was too busy to take is sent again after a while */
+            while (res == TECNICOFS_ERROR_BUSY) {
+                usleep(backoff);
+                if (backoff < BUSY_BACKOFF_MAX) backoff *= 2;
+                ticket = sendCommand(&pending[i]);
+                res = ticket < 0 ? ticket : tfsWait(ticket);
+            }
+            printResult(&pending[i], res);
+        }
+    }
+
+    numPending = 0;
+}
+
+
+/*
+ * Sends the pending commands to the server, as few batches as possible, and reports their
+ * results in the order they were read.
+ * */
+void flushCommands() {
+    int results[TFS_MAX_BATCH];
+    int first = 0;
+    int backoff = BUSY_BACKOFF_MIN;
+
+    if (sendMode == 'a') {
+        flushAsyncCommands();
+        return;
+    }
+    if (sendMode == 'o') {
+        flushSingleCommands();
+        return;
+    }
+
+    while (first < numPending) {
+        int last = first;
+
+        /* a batch ends when the message can't hold the next command */
+        tfsBatchBegin();
+        while (last < numPending && queueCommand(&pending[last]) >= 0) last++;
+
+        /* a command that doesn't fit an empty batch is too long to ever be sent */
+        if (last == first) {
+            tfsBatchSubmit(results);
+            printResult(&pending[first], TECNICOFS_ERROR_OTHER);
+            first++;
+            continue;
+        }
+
+        int n = tfsBatchSubmit(results);
+
+        /* the server didn't run any of them, so the same batch is sent again after a while */
+        if (n == TECNICOFS_ERROR_BUSY) {
+            usleep(backoff);
+            if (backoff < BUSY_BACKOFF_MAX) backoff *= 2;
+            continue;
+        }
+        backoff = BUSY_BACKOFF_MIN;
+
+        for (int i = first; i < last; i++)
+            printResult(&pending[i], n < 0 ? n : results[i - first]);
+
+        first = last;
+    }
+
+    numPending = 0;
+}
+
+
 void errorParse(){
+    /* commands read before the invalid one still run */
+    flushCommands();
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
 
 void *processInput() {
-    char line[MAX_INPUT_SIZE];
+    char line[2 * MAX_PATH_SIZE + 4];
 
     while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
-        char op;
-        char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+        command *cmd = &pending[numPending];
         int res;
 
-        int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
+        int numTokens = sscanf(line, "%c %s %s", &cmd->op, cmd->arg1, cmd->arg2);
 
         /* perform minimal validation */
         if (numTokens < 1) {
             continue;
         }
-        switch (op) {
+        switch (cmd->op) {
             case 'c':
                 if(numTokens != 3) {
                     errorParse();
                     break;
                 }
-                switch (arg2[0]) {
-
-                    case 'f':
-                        res = tfsCreate(arg1, *arg2);
-                        if (!res)
-                          printf("Created file: %s\n", arg1);
-                        else
-                          printf("Unable to create file: %s\n", arg1);
-                        break;
-
-                    case 'd':
-                        res = tfsCreate(arg1, *arg2);
-                        if (!res)
-                          printf("Created directory: %s\n", arg1);
-                        else
-                          printf("Unable to create directory: %s\n", arg1);
-                        break;
-
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
+                if (cmd->arg2[0] != 'f' && cmd->arg2[0] != 'd') {
+                    fprintf(stderr, "Error: invalid node type\n");
+                    break;
                 }
+                numPending++;
                 break;
 
             case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsLookup(arg1);
-                if (res >= 0)
-                    printf("Search: %s found\n", arg1);
-                else
-                    printf("Search: %s not found\n", arg1);
-                break;
-
             case 'd':
                 if(numTokens != 2)
                     errorParse();
-                res = tfsDelete(arg1);
-                if (!res)
-                  printf("Deleted: %s\n", arg1);
-                else
-                  printf("Unable to delete: %s\n", arg1);
+                numPending++;
                 break;
 
             case 'm':
                 if(numTokens != 3)
                     errorParse();
-                res = tfsMove(arg1, arg2);
-                if (!res)
-                  printf("Moved: %s to %s\n", arg1, arg2);
-                else
-                  printf("Unable to move: %s to %s\n", arg1, arg2);
+                numPending++;
                 break;
 
             case 'p':
-                res = tfsPrint(arg1);
-                if (! res) printf("Printed tfs to %s\n", arg1);
-                else printf("Unable to print to %s\n", arg1);
+                flushCommands();
+                res = tfsPrint(cmd->arg1);
+                if (! res) printf("Printed tfs to %s\n", cmd->arg1);
+                else printf("Unable to print to %s\n", cmd->arg1);
+                break;
+
+            case 's':
+                flushCommands();
+                if (tfsDumpBegin() == 0) {
+                    char *path;
+                    while ((path = tfsDumpNext()) != NULL)
+                        printf("Entry: %s\n", path);
+                }
+                if (! tfsDumpEnd()) printf("Streamed tfs\n");
+                else printf("Unable to stream tfs\n");
+                break;
+
+            case 'i': {
+                int64_t seq;
+                flushCommands();
+                res = tfsPrintChanges(cmd->arg1, lastChanges, &seq);
+                if (res == 0) {
+                    printf("Printed changes since %" PRId64 " to %s\n", lastChanges, cmd->arg1);
+                    lastChanges = seq;
+                }
+                else printf("Unable to print changes to %s\n", cmd->arg1);
+                break;
+            }
+
+            /* commands that follow are sent as asynchronous requests, in batches or one at a time */
+            case 'a':
+            case 'b':
+            case 'o':
+                flushCommands();
+                sendMode = cmd->op;
+                break;
+
+            case 't':
+                flushCommands();
+                if (numTokens == 2 && tfsSetTimeout(atoi(cmd->arg1)) == 0)
+                    printf("Timeout set to %s ms\n", cmd->arg1);
+                else
+                    printf("Unable to set timeout to %s ms\n", cmd->arg1);
                 break;
 
             case '#':
@@ -125,7 +352,10 @@ void *processInput() {
                 errorParse();
             }
         }
+
+        if (numPending == TFS_MAX_BATCH) flushCommands();
     }
+    flushCommands();
     fclose(inputFile);
     return NULL;
 }
@@ -134,9 +364,9 @@ int main(int argc, char* argv[]) {
     parseArgs(argc, argv);
 
     if (tfsMount(serverName) == 0)
-      printf("Mounted! (socket = %s)\n", serverName);
+      printf("Mounted! (socket = %s)\n", serverName ? serverName : "embedded");
     else {
-      fprintf(stderr, "Unable to mount socket: %s\n", serverName);
+      fprintf(stderr, "Unable to mount socket: %s\n", serverName ? serverName : "embedded");
       exit(EXIT_FAILURE);
     }
 
@@ -0,0 +1,112 @@
+#include "coroutine.h"
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+/* coroutine being run by this thread (NULL if none) */
+static __thread coroutine *running = NULL;
+
+
+/*
+ * Gives a coroutine its stack. Stacks are mapped, so only the pages a coroutine touches take
+ * memory, and an overflow hits the guard page instead of another stack.
+ *
+ * Input:
+ *   - co: coroutine to set up
+ *   - stack_size: bytes of its stack
+ * Returns: SUCCESS or FAIL
+ * */
+int coroutine_init(coroutine *co, size_t stack_size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    co->stack_size = (stack_size + page - 1) / page * page;
+    co->stack = mmap(NULL, co->stack_size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (co->stack == MAP_FAILED) return FAIL;
+
+    /* stacks grow down, so the guard goes at the start of the mapping */
+    if (mprotect(co->stack, page, PROT_NONE) != 0) {
+        munmap(co->stack, co->stack_size + page);
+        return FAIL;
+    }
+
+    co->done = 1;
+    return SUCCESS;
+}
+
+
+/*
+ * Frees the stack of a coroutine that isn't running.
+ *
+ * Input:
+ *   - co: coroutine set up by coroutine_init
+ * */
+void coroutine_destroy(coroutine *co) {
+    munmap(co->stack, co->stack_size + sysconf(_SC_PAGESIZE));
+}
+
+
+/*
+ * First function run on a coroutine's stack. makecontext only passes ints, so the coroutine is
+ * found through running instead.
+ * */
+static void coroutine_entry() {
+    coroutine *co = running;
+    co->fn(co->arg);
+    co->done = 1;
+    /* returning goes to uc_link, the caller of the last resume */
+}
+
+
+/*
+ * Prepares a coroutine that is done to run a function from its start, on the next resume.
+ *
+ * Input:
+ *   - co: coroutine set up by coroutine_init
+ *   - fn: function to run
+ *   - arg: argument passed to fn
+ * */
+void coroutine_start(coroutine *co, coroutine_fn fn, void *arg) {
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp = co->stack + sysconf(_SC_PAGESIZE);
+    co->context.uc_stack.ss_size = co->stack_size;
+    co->context.uc_link = &co->caller;
+    makecontext(&co->context, coroutine_entry, 0);
+
+    co->fn = fn;
+    co->arg = arg;
+    co->done = 0;
+}
+
+
+/*
+ * Runs a coroutine until it yields or ends.
+ *
+ * Input:
+ *   - co: coroutine prepared by coroutine_start
+ * Returns: 1 if the coroutine ended, 0 if it yielded
+ * */
+int coroutine_resume(coroutine *co) {
+    coroutine *previous = running;
+
+    running = co;
+    swapcontext(&co->caller, &co->context);
+    running = previous;
+
+    return co->done;
+}
+
+
+/*
+ * Goes back to whoever resumed the running coroutine. Outside a coroutine there is nothing to
+ * switch to, so the thread gives its CPU away instead.
+ * */
+void coroutine_yield() {
+    coroutine *co = running;
+
+    if (co == NULL) {
+        sched_yield();
+        return;
+    }
+    swapcontext(&co->context, &co->caller);
+}
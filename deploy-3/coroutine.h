@@ -0,0 +1,31 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stddef.h>
+#include <ucontext.h>
+#include "fs/state.h"  /* SUCCESS and FAIL */
+
+/* runs inside a coroutine */
+typedef void (*coroutine_fn)(void *arg);
+
+/*
+ * Coroutine with a stack of its own, run by a single thread. It runs until it yields or ends,
+ * and a later resume carries on from where it yielded
+ */
+typedef struct coroutine {
+    ucontext_t context;
+    ucontext_t caller;  /* where yields and the end of fn go back to */
+    char *stack;  /* mapping with a guard page below the stack */
+    size_t stack_size;
+    coroutine_fn fn;
+    void *arg;
+    int done;
+} coroutine;
+
+int coroutine_init(coroutine *co, size_t stack_size);
+void coroutine_destroy(coroutine *co);
+void coroutine_start(coroutine *co, coroutine_fn fn, void *arg);
+int coroutine_resume(coroutine *co);
+void coroutine_yield();
+
+#endif /* COROUTINE_H */
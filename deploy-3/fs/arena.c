@@ -0,0 +1,331 @@
+#include "arena.h"
+#include "state.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+
+/* pages new arenas are mapped with. lowered for good when the kind asked for is unavailable */
+static int arena_page_kind = ARENA_PAGES_NORMAL;
+
+/* slots of the caches set up, and the generation given to the last one set up */
+static int slab_slots = 0;
+static unsigned slab_generation = 0;
+
+/* fronts of this thread, one for each cache slot */
+static __thread slab_front slab_fronts[SLAB_CACHES];
+
+/* key whose destructor gives a thread's fronts back when it exits */
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Chooses the pages new arenas are mapped with. Meant to be called before the file system is
+ * set up, so every arena gets the same kind.
+ *
+ * Input:
+ *   - pages: ARENA_PAGES_* kind
+ * Returns: SUCCESS or FAIL if the kind is unknown
+ * */
+int arena_set_pages(int pages) {
+    if (pages != ARENA_PAGES_NORMAL && pages != ARENA_PAGES_THP && pages != ARENA_PAGES_HUGETLB) return FAIL;
+    __atomic_store_n(&arena_page_kind, pages, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/*
+ * Returns: kind of pages arenas are being mapped with, which is lower than the one asked for if
+ *          the system didn't have it
+ * */
+int arena_pages() {
+    return __atomic_load_n(&arena_page_kind, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Input:
+ *   - size: bytes asked for
+ * Returns: size of the mapping that holds them, a whole number of arenas
+ * */
+static size_t arena_round(size_t size) {
+    return (size + ARENA_SIZE - 1) / ARENA_SIZE * ARENA_SIZE;
+}
+
+
+/*
+ * Maps zeroed memory with the pages chosen by arena_set_pages. Reserved huge pages fall back to
+ * transparent ones when none are left, and those to normal pages when the kernel has them
+ * disabled; each fallback is reported once.
+ *
+ * Input:
+ *   - size: bytes to map
+ * Returns: start of the mapping, aligned to ARENA_SIZE for huge pages, or NULL
+ * */
+void *arena_map(size_t size) {
+    size = arena_round(size);
+
+    if (arena_pages() == ARENA_PAGES_HUGETLB) {
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) return ptr;
+
+        fprintf(stderr, "Warning: no huge pages reserved, using transparent huge pages\n");
+        __atomic_store_n(&arena_page_kind, ARENA_PAGES_THP, __ATOMIC_RELAXED);
+    }
+
+    if (arena_pages() == ARENA_PAGES_NORMAL) {
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr != MAP_FAILED ? ptr : NULL;
+    }
+
+    /* the kernel only backs aligned huge page ranges with huge pages, so an aligned range is
+     * cut out of a larger mapping */
+    char *ptr = mmap(NULL, size + ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+
+    char *start = (char *) (((uintptr_t) ptr + ARENA_SIZE - 1) & ~((uintptr_t) ARENA_SIZE - 1));
+    if (start > ptr) munmap(ptr, start - ptr);
+    munmap(start + size, ptr + ARENA_SIZE - start);
+
+    if (madvise(start, size, MADV_HUGEPAGE) != 0) {
+        fprintf(stderr, "Warning: transparent huge pages are disabled, using normal pages\n");
+        __atomic_store_n(&arena_page_kind, ARENA_PAGES_NORMAL, __ATOMIC_RELAXED);
+    }
+    return start;
+}
+
+
+/*
+ * Unmaps memory mapped by arena_map.
+ *
+ * Input:
+ *   - ptr: start of the mapping
+ *   - size: bytes given to arena_map
+ * */
+void arena_unmap(void *ptr, size_t size) {
+    munmap(ptr, arena_round(size));
+}
+
+
+/*
+ * Gives every object held by a front back to its cache.
+ *
+ * Input:
+ *   - front: front of the calling thread
+ * */
+static void slab_front_drain(slab_front *front) {
+    slab_cache *cache = front->cache;
+
+    /* a front of a cache that was destroyed holds nothing worth keeping */
+    if (cache != NULL && front->generation == __atomic_load_n(&cache->generation, __ATOMIC_RELAXED) && front->free != NULL) {
+        slab_free_object *last = front->free;
+        while (last->next != NULL) last = last->next;
+
+        assert__(pthread_mutex_lock(&cache->lock) == 0, "Error: slab_front_drain failed to lock!\n")
+        last->next = cache->free;
+        cache->free = front->free;
+        assert__(pthread_mutex_unlock(&cache->lock) == 0, "Error: slab_front_drain failed to unlock!\n")
+    }
+
+    /* what is left of the run is lost until the cache is destroyed, as are the ends of arenas */
+    front->free = NULL;
+    front->count = 0;
+    front->next = front->end = NULL;
+}
+
+
+/*
+ * Destructor of slab_key: gives the fronts of an exiting thread back.
+ *
+ * Input:
+ *   - ptr: fronts of the thread
+ * */
+static void slab_thread_exit(void *ptr) {
+    slab_front *fronts = ptr;
+    for (int i = 0; i < SLAB_CACHES; i++) slab_front_drain(&fronts[i]);
+}
+
+
+static void slab_key_create() {
+    assert__(pthread_key_create(&slab_key, slab_thread_exit) == 0, "Error: couldn't create the slab key!\n")
+}
+
+
+/*
+ * Input:
+ *   - cache: cache used by the calling thread
+ * Returns: front of the calling thread for the cache, emptied if it was left by an earlier cache
+ * */
+static slab_front *slab_front_of(slab_cache *cache) {
+    slab_front *front = &slab_fronts[cache->id];
+
+    if (front->cache != cache || front->generation != cache->generation) {
+        /* the first front of a thread makes it give them back when it exits */
+        if (pthread_getspecific(slab_key) == NULL) pthread_setspecific(slab_key, slab_fronts);
+
+        front->cache = cache;
+        front->generation = cache->generation;
+        front->free = NULL;
+        front->count = 0;
+        front->next = front->end = NULL;
+    }
+    return front;
+}
+
+
+/*
+ * Sets up an empty cache. Arenas are only mapped once objects are allocated.
+ *
+ * Input:
+ *   - cache: cache to set up
+ *   - size: bytes of each object (at most an arena, minus the page with the link to the previous one)
+ * Returns: SUCCESS or FAIL
+ * */
+int slab_init(slab_cache *cache, size_t size) {
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (size + SLAB_PAGE > ARENA_SIZE) return FAIL;
+
+    pthread_once(&slab_key_once, slab_key_create);
+
+    /* slots are reused by the caches of a file system set up again, so they never run out */
+    int id = __atomic_fetch_add(&slab_slots, 1, __ATOMIC_RELAXED) % SLAB_CACHES;
+
+    /* each run is a whole number of pages, at most what is left of an arena after its link */
+    size_t run = (SLAB_BATCH * size + SLAB_PAGE - 1) / SLAB_PAGE * SLAB_PAGE;
+    if (run > ARENA_SIZE - SLAB_PAGE) run = (ARENA_SIZE - SLAB_PAGE) / size * size;
+
+    cache->size = size;
+    cache->run = run;
+    cache->id = id;
+    cache->generation = __atomic_add_fetch(&slab_generation, 1, __ATOMIC_RELAXED);
+    cache->free = NULL;
+    cache->next = cache->end = NULL;
+    cache->arenas = NULL;
+
+    return pthread_mutex_init(&cache->lock, NULL) == 0 ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Unmaps every arena of a cache, with all its objects.
+ *
+ * Input:
+ *   - cache: cache set up by slab_init
+ * */
+void slab_destroy(slab_cache *cache) {
+    while (cache->arenas != NULL) {
+        void *prev = *(void **) cache->arenas;
+        arena_unmap(cache->arenas, ARENA_SIZE);
+        cache->arenas = prev;
+    }
+    cache->free = NULL;
+    cache->next = cache->end = NULL;
+    __atomic_store_n(&cache->generation, 0, __ATOMIC_RELAXED);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+
+/*
+ * Fills the front of the calling thread: with up to SLAB_BATCH freed objects if the cache has
+ * any, or else with a run of pages to carve, mapping a new arena when the others are full.
+ *
+ * Input:
+ *   - cache: cache of the front
+ *   - front: front of the calling thread, empty
+ * */
+static void slab_refill(slab_cache *cache, slab_front *front) {
+
+    assert__(pthread_mutex_lock(&cache->lock) == 0, "Error: slab_refill failed to lock!\n")
+
+    if (cache->free != NULL) {
+        front->free = cache->free;
+        slab_free_object *last = cache->free;
+        for (front->count = 1; front->count < SLAB_BATCH && last->next != NULL; front->count++) last = last->next;
+        cache->free = last->next;
+        last->next = NULL;
+    }
+    else {
+        if (cache->next == NULL || cache->next + cache->run > cache->end) {
+            char *arena = arena_map(ARENA_SIZE);
+            if (arena != NULL) {
+                *(void **) arena = cache->arenas;
+                cache->arenas = arena;
+                /* runs start at page boundaries, past the page with the link */
+                cache->next = arena + SLAB_PAGE;
+                cache->end = arena + ARENA_SIZE;
+            }
+        }
+        if (cache->next != NULL && cache->next + cache->run <= cache->end) {
+            front->next = cache->next;
+            front->end = cache->next + cache->run;
+            cache->next += cache->run;
+        }
+    }
+
+    assert__(pthread_mutex_unlock(&cache->lock) == 0, "Error: slab_refill failed to unlock!\n")
+}
+
+
+/*
+ * Allocates an object from the front of the calling thread, which is filled from the cache when
+ * it runs out.
+ *
+ * Input:
+ *   - cache: cache of the object's size
+ * Returns: object (not zeroed) or NULL if no memory is left
+ * */
+void *slab_alloc(slab_cache *cache) {
+    slab_front *front = slab_front_of(cache);
+
+    if (front->free == NULL && (front->next == NULL || front->next + cache->size > front->end)) {
+        front->next = front->end = NULL;
+        slab_refill(cache, front);
+    }
+
+    if (front->free != NULL) {
+        void *object = front->free;
+        front->free = front->free->next;
+        front->count--;
+        return object;
+    }
+    if (front->next != NULL && front->next + cache->size <= front->end) {
+        void *object = front->next;
+        front->next += cache->size;
+        return object;
+    }
+    return NULL;
+}
+
+
+/*
+ * Gives an object back to the front of the calling thread, which passes its older objects on to
+ * the cache once it holds 2 * SLAB_BATCH. NULL is ignored, as with free.
+ *
+ * Input:
+ *   - cache: cache the object was allocated from
+ *   - object: object to free
+ * */
+void slab_free(slab_cache *cache, void *object) {
+    if (object == NULL) return;
+
+    slab_front *front = slab_front_of(cache);
+    ((slab_free_object *) object)->next = front->free;
+    front->free = object;
+    if (++front->count < 2 * SLAB_BATCH) return;
+
+    /* the newest SLAB_BATCH objects stay, the older ones go back for other threads */
+    slab_free_object *last = front->free;
+    for (int i = 1; i < SLAB_BATCH; i++) last = last->next;
+    slab_free_object *given = last->next;
+    last->next = NULL;
+    front->count = SLAB_BATCH;
+
+    slab_free_object *tail = given;
+    while (tail->next != NULL) tail = tail->next;
+
+    assert__(pthread_mutex_lock(&cache->lock) == 0, "Error: slab_free failed to lock!\n")
+    tail->next = cache->free;
+    cache->free = given;
+    assert__(pthread_mutex_unlock(&cache->lock) == 0, "Error: slab_free failed to unlock!\n")
+}
@@ -0,0 +1,73 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* pages the arenas are mapped with. each kind falls back to the next one when unavailable */
+#define ARENA_PAGES_NORMAL 0
+#define ARENA_PAGES_THP 1  /* transparent huge pages, asked for with madvise */
+#define ARENA_PAGES_HUGETLB 2  /* huge pages reserved in /proc/sys/vm/nr_hugepages */
+
+/* size of each arena, which is one huge page on x86-64 */
+#define ARENA_SIZE (2 * 1024 * 1024)
+
+/* objects are carved at multiples of this, which keeps them aligned for any field */
+#define ARENA_ALIGN 16
+
+/* caches that can be set up at once, each with a front in every thread */
+#define SLAB_CACHES 4
+
+/* objects a thread moves between its front and the cache at a time. a front holds at most
+ * twice as many freed objects before giving some back */
+#define SLAB_BATCH 32
+
+/* threads carve their objects from runs of whole pages of this size, so the pages of the
+ * objects a thread allocates are first touched by it */
+#define SLAB_PAGE 4096
+
+/*
+ * Freed object, linked to the next free one
+ */
+typedef struct slab_free_object {
+    struct slab_free_object *next;
+} slab_free_object;
+
+/*
+ * Allocator of objects of one size, carved from arenas. Each thread allocates from and frees to
+ * a front of its own and only takes the lock to move SLAB_BATCH objects, or a run of pages,
+ * between its front and the cache. Freed objects are reused before the newest arena is carved
+ * further, so objects stay packed in as few pages as possible
+ */
+typedef struct slab_cache {
+    size_t size;  /* bytes of each object, rounded up to ARENA_ALIGN */
+    size_t run;  /* bytes of the runs of pages handed to fronts */
+    int id;  /* front of the cache in each thread */
+    unsigned generation;  /* tells fronts left over from an earlier cache in the same slot */
+    slab_free_object *free;
+    char *next, *end;  /* room left in the newest arena */
+    void *arenas;  /* newest arena; each one starts with a pointer to the one before it */
+    pthread_mutex_t lock;
+} slab_cache;
+
+/*
+ * Objects of a cache held by one thread
+ */
+typedef struct slab_front {
+    slab_cache *cache;
+    unsigned generation;  /* generation of the cache when the front was filled */
+    slab_free_object *free;
+    int count;  /* objects in free */
+    char *next, *end;  /* room left in the run being carved */
+} slab_front;
+
+int arena_set_pages(int pages);
+int arena_pages();
+void *arena_map(size_t size);
+void arena_unmap(void *ptr, size_t size);
+int slab_init(slab_cache *cache, size_t size);
+void slab_destroy(slab_cache *cache);
+void *slab_alloc(slab_cache *cache);
+void slab_free(slab_cache *cache, void *object);
+
+#endif /* ARENA_H */
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "namespace.h"
+#include "../tecnicofs-namespace.h"
+
+
+/* mirror kept up to date by the commits (NULL if the server doesn't publish one) */
+static tfs_ns_region *mirror = NULL;
+
+
+/*
+ * Removes a mirror left by a previous server at the given path, marking it closed so the
+ * clients that still map it stop trusting it. Called whether or not the new server publishes
+ * a mirror of its own.
+ * Input:
+ *  - path: path of the mirror
+ */
+void namespace_retire(char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd == -1) return;
+
+    tfs_ns_region *old = mmap(NULL, sizeof(tfs_ns_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (old != MAP_FAILED) {
+        __atomic_store_n(&old->closed, 1, __ATOMIC_RELEASE);
+        munmap(old, sizeof(tfs_ns_region));
+    }
+    close(fd);
+    unlink(path);
+}
+
+
+/*
+ * Creates the namespace mirror at the given path, with every i-node free.
+ * Input:
+ *  - path: path of the mirror, retired beforehand
+ * Returns: SUCCESS or FAIL
+ */
+int namespace_open(char *path) {
+    size_t size = tfs_ns_size(INODE_TABLE_SIZE, MAX_DIR_ENTRIES);
+
+    /* clients map it read-only, and only those of the server's own user may open it. the others
+     * fail to and send their lookups to the server */
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) return FAIL;
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return FAIL;
+    }
+
+    tfs_ns_region *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return FAIL;
+
+    region->inodes = INODE_TABLE_SIZE;
+    region->entries = MAX_DIR_ENTRIES;
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) tfs_ns_inode_at(region, i)->node_type = T_NONE;
+
+    /* clients check the version last, so they never see a region that is half set up */
+    __atomic_store_n(&region->version, TFS_NS_VERSION, __ATOMIC_RELEASE);
+    mirror = region;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Starts an update of the mirror. Updates are made by inode_commit, one at a time.
+ */
+void namespace_begin() {
+    if (mirror == NULL) return;
+
+    /* the odd seq must be visible before any of the changes */
+    __atomic_store_n(&mirror->seq, mirror->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/*
+ * Copies the newest version of an i-node to the mirror.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - version: version being committed
+ */
+void namespace_publish(int inumber, inode_version *version) {
+    if (mirror == NULL) return;
+
+    tfs_ns_inode *inode = tfs_ns_inode_at(mirror, inumber);
+    inode->node_type = version->nodeType;
+
+    if (version->dirEntries == NULL) return;
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+        inode->entries[i].inumber = version->dirEntries[i].inumber;
+        if (version->dirEntries[i].inumber != FREE_INODE)
+            memcpy(inode->entries[i].name, version->dirEntries[i].name, MAX_FILE_NAME);
+    }
+}
+
+
+/*
+ * Ends an update of the mirror, letting readers trust what they read again.
+ */
+void namespace_end() {
+    if (mirror == NULL) return;
+    __atomic_store_n(&mirror->seq, mirror->seq + 1, __ATOMIC_RELEASE);
+}
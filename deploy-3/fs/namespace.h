@@ -0,0 +1,12 @@
+#ifndef NAMESPACE_H
+#define NAMESPACE_H
+
+#include "state.h"
+
+void namespace_retire(char *path);
+int namespace_open(char *path);
+void namespace_begin();
+void namespace_publish(int inumber, inode_version *version);
+void namespace_end();
+
+#endif /* NAMESPACE_H */
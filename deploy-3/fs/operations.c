@@ -1,7 +1,70 @@
 #include "operations.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+
+/*
+ * Tree dump shared by the print workers
+ */
+typedef struct print_job {
+    print_unit *units;
+    int amount;
+    int next;  /* next unit to be claimed by a worker */
+    long snapshot;
+    pthread_mutex_t lock;  /* used to wait for units being dumped by other workers */
+    pthread_cond_t cond_done;
+    int helpers;  /* print workers dumping its units, which the owner waits to leave */
+    struct print_job *next_open;
+} print_job;
+
+/* trees split into this many units or fewer are dumped by the calling thread alone */
+#define PRINT_INLINE_UNITS PRINT_WORKERS
+
+/*
+ * Print workers, started with the first print that needs them and kept for the rest of the
+ * program. Jobs with units left to claim are open to them
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond_open;  /* signaled when a job is opened */
+    pthread_cond_t cond_left;  /* signaled when a worker leaves a job */
+    print_job *open;
+} print_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL };
+
+static pthread_once_t print_pool_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Lookup being executed, whose result is shared with identical lookups that arrive before any
+ * commit changes what it sees. It lives on the stack of the thread executing it
+ */
+typedef struct lookup_flight {
+    char *path;
+    long snapshot;
+    int result;
+    int done;
+    int waiters;  /* threads waiting for the result, which the owner waits to leave */
+    struct lookup_flight *next;
+} lookup_flight;
+
+/*
+ * Bucket of the table of lookups in flight
+ */
+typedef struct flight_bucket {
+    lookup_flight *flights;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_done;  /* signaled when a flight lands and when its last waiter leaves */
+} flight_bucket;
+
+flight_bucket flight_table[LOOKUP_FLIGHT_BUCKETS];
+
+/* lookups answered with the result of another one */
+long lookups_coalesced = 0;
 
 
 /* Given a path, fills pointers with strings for the parent path and child
@@ -61,12 +124,40 @@ int check_if_node_is_in_array(int inumber, const int *arr, int size) {
 }
 
 
+/*
+ * Writes a path in the same format used by the tree dump: every component preceded by a '/'.
+ * Input:
+ *  - path: path to normalize
+ *  - normalized: buffer with MAX_PATH_SIZE bytes that gets the result
+ * Return:
+ *  - normalized path
+ * */
+char *normalize_path(const char *path, char *normalized) {
+    int size = 0;
+
+    for (int i = 0; path[i] != '\0' && size < MAX_PATH_SIZE - 1; i++) {
+        if (path[i] == '/') continue;
+        if (i == 0 || path[i - 1] == '/') normalized[size++] = '/';
+        if (size < MAX_PATH_SIZE - 1) normalized[size++] = path[i];
+    }
+    normalized[size] = '\0';
+
+    return normalized;
+}
+
+
 /*
  * Initializes tecnicofs and creates root node.
  */
 void init_fs() {
     inode_table_init();
 
+    for (int i = 0; i < LOOKUP_FLIGHT_BUCKETS; i++) {
+        flight_table[i].flights = NULL;
+        assert__(pthread_mutex_init(&flight_table[i].lock, NULL) == 0, "Error: init_fs failed to create a lock!\n")
+        assert__(pthread_cond_init(&flight_table[i].cond_done, NULL) == 0, "Error: init_fs failed to create a condition!\n")
+    }
+
     /* create root inode */
     int root = inode_create(T_DIRECTORY);
 
@@ -74,6 +165,9 @@ void init_fs() {
         printf("failed to create node for tecnicofs root\n");
         exit(EXIT_FAILURE);
     }
+
+    /* makes root visible to readers */
+    inode_commit();
 }
 
 
@@ -82,6 +176,11 @@ void init_fs() {
  */
 void destroy_fs() {
     inode_table_destroy();
+
+    for (int i = 0; i < LOOKUP_FLIGHT_BUCKETS; i++) {
+        pthread_mutex_destroy(&flight_table[i].lock);
+        pthread_cond_destroy(&flight_table[i].cond_done);
+    }
 }
 
 
@@ -132,12 +231,12 @@ int lookup_sub_node(char *name, DirEntry *entries) {
  * Input:
  *  - name: path of node
  *  - nodeType: type of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
  */
 int create(char *name, type nodeType){
 
     int parent_inumber, child_inumber;
-    char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+    char *parent_name, *child_name, name_copy[MAX_PATH_SIZE];
     /* use for copy */
     type pType;
     union Data pdata;
@@ -149,13 +248,24 @@ int create(char *name, type nodeType){
     strcpy(name_copy, name);
     split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
+    /* checked before allocating the inode, which would otherwise be lost */
+    if (strlen(child_name) >= MAX_FILE_NAME) {
+        printf("failed to create %s, name is too long\n", name);
+        return TECNICOFS_ERROR_OTHER;
+    }
+
     /* gets parent directory's inode number (locks all the used inodes) */
     parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, 0);
 
+    if (parent_inumber == EXPIRED) {
+        unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+        return TECNICOFS_ERROR_TIMEOUT;
+    }
+
     if (parent_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s, invalid parent dir %s\n", name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     /* gets parent inode info */
@@ -164,13 +274,13 @@ int create(char *name, type nodeType){
     if(pType != T_DIRECTORY) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s, parent %s is not a dir\n", name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s, already exists in dir %s\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
     }
 
     /* create node and add entry to folder that contains new node */
@@ -178,15 +288,19 @@ int create(char *name, type nodeType){
     if (child_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s in  %s, couldn't allocate inode\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
     if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not add entry %s in dir %s\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
+    /* records the change so that incremental prints can report it */
+    char normalized[MAX_PATH_SIZE];
+    inode_log_change('c', nodeType, normalize_path(name, normalized), NULL);
+
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
@@ -197,12 +311,12 @@ int create(char *name, type nodeType){
  * Deletes a node given a path.
  * Input:
  *  - name: path of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
  */
 int delete(char *name){
 
     int parent_inumber, child_inumber;
-    char *parent_name, *child_name, name_copy[MAX_FILE_NAME];
+    char *parent_name, *child_name, name_copy[MAX_PATH_SIZE];
     /* use for copy */
     type pType, cType;
     union Data pdata, cdata;
@@ -217,10 +331,15 @@ int delete(char *name){
     /* gets parent directory's inode number (locks all the used inodes) */
     parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, 0);
 
+    if (parent_inumber == EXPIRED) {
+        unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+        return TECNICOFS_ERROR_TIMEOUT;
+    }
+
     if (parent_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to delete %s, invalid parent dir %s\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     inode_get(parent_inumber, &pType, &pdata);
@@ -228,7 +347,7 @@ int delete(char *name){
     if(pType != T_DIRECTORY) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to delete %s, parent %s is not a dir\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
@@ -236,11 +355,14 @@ int delete(char *name){
     if (child_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete %s, does not exist in dir %s\n", name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     /* locks (write) the directory where file/directory will be created */
-    assert__(lock_write(child_inumber) == SUCCESS, "Error: delete failed to lock an inode!\n")
+    if (lock_write(child_inumber) == FAIL) {
+        unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+        return TECNICOFS_ERROR_TIMEOUT;
+    }
     locked_inumbers[amount++] = child_inumber;
 
     inode_get(child_inumber, &cType, &cdata);
@@ -248,22 +370,26 @@ int delete(char *name){
     if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete %s: is a directory and not empty\n", name);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
     /* remove entry from folder that contained deleted node */
     if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to delete %s from dir %s\n", child_name, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
     if (inode_delete(child_inumber) == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete inode number %d from dir %s\n", child_inumber, parent_name);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
+    /* records the change so that incremental prints can report it */
+    char normalized[MAX_PATH_SIZE];
+    inode_log_change('d', T_NONE, normalize_path(name, normalized), NULL);
+
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
@@ -271,39 +397,106 @@ int delete(char *name){
 
 
 /*
- * Lookup for a given path.
+ * Input:
+ *  - name: path of node
+ * Returns: bucket of the lookups in flight for the path
+ */
+flight_bucket *flight_bucket_of(char *name) {
+    unsigned hash = 5381;
+    for (char *c = name; *c != '\0'; c++) hash = hash * 33 + (unsigned char) *c;
+    return &flight_table[hash % LOOKUP_FLIGHT_BUCKETS];
+}
+
+
+/*
+ * Lookup for a given path. Reads from a snapshot, so it never waits for writers.
+ *
+ * Identical lookups that run at the same time are done once: a lookup joins one already in
+ * flight for the same path, and takes its result, as long as no commit happened since that
+ * one took its snapshot. The result is then the one it would have found by itself, so no write
+ * is ever seen out of order; a lookup that arrives after a commit starts a flight of its own.
  * Input:
  *  - name: path of node
  * Returns:
  *  inumber: identifier of the i-node, if found
- *     FAIL: otherwise
+ *     TECNICOFS_ERROR_FILE_NOT_FOUND: otherwise
  */
 int lookup(char *name) {
 
-    /* holds all the inode id's locked while doing this operation */
-    int locked_inumbers[MAX_PATH_INODE_LENGTH];
-    int amount = 0;
+    flight_bucket *bucket = flight_bucket_of(name);
+    lookup_flight flight, *joined;
+    int res;
+
+    assert__(pthread_mutex_lock(&bucket->lock) == 0, "Error: lookup failed to lock!\n")
 
-    /* traverses path and lock all the used inodes */
-    int res = traverse_path(name, locked_inumbers, &amount, 1);
+    /* only a flight seeing the latest commit gives the answer a new snapshot would */
+    long now = commit_clock_now();
+    for (joined = bucket->flights; joined != NULL; joined = joined->next)
+        if (joined->snapshot == now && strcmp(joined->path, name) == 0) break;
 
-    /* unlocks all the used nodes */
-    unlock_inodes(locked_inumbers, amount);
+    if (joined != NULL) {
+        joined->waiters++;
+        while (! joined->done)
+            assert__(pthread_cond_wait(&bucket->cond_done, &bucket->lock) == 0, "Error: lookup failed to wait!\n")
+        res = joined->result;
+        if (--joined->waiters == 0)
+            assert__(pthread_cond_broadcast(&bucket->cond_done) == 0, "Error: lookup failed to signal!\n")
+        assert__(pthread_mutex_unlock(&bucket->lock) == 0, "Error: lookup failed to unlock!\n")
+
+        __atomic_add_fetch(&lookups_coalesced, 1, __ATOMIC_RELAXED);
+        return res;
+    }
+
+    /* the snapshot is taken before the flight is visible, so joiners compare the right stamp */
+    flight.path = name;
+    flight.snapshot = snapshot_begin();
+    flight.done = flight.waiters = 0;
+    flight.next = bucket->flights;
+    bucket->flights = &flight;
+    assert__(pthread_mutex_unlock(&bucket->lock) == 0, "Error: lookup failed to unlock!\n")
+
+    res = snapshot_traverse_path(name, flight.snapshot);
+    snapshot_end();
+    res = res == FAIL ? TECNICOFS_ERROR_FILE_NOT_FOUND : res;
+
+    /* lands the flight and waits for its waiters to take the result off the stack */
+    assert__(pthread_mutex_lock(&bucket->lock) == 0, "Error: lookup failed to lock!\n")
+    lookup_flight **link = &bucket->flights;
+    while (*link != &flight) link = &(*link)->next;
+    *link = flight.next;
+
+    flight.result = res;
+    flight.done = 1;
+    if (flight.waiters > 0) {
+        assert__(pthread_cond_broadcast(&bucket->cond_done) == 0, "Error: lookup failed to signal!\n")
+        while (flight.waiters > 0)
+            assert__(pthread_cond_wait(&bucket->cond_done, &bucket->lock) == 0, "Error: lookup failed to wait!\n")
+    }
+    assert__(pthread_mutex_unlock(&bucket->lock) == 0, "Error: lookup failed to unlock!\n")
 
     return res;
 }
 
 
+/*
+ * Returns: number of lookups answered with the result of an identical one in flight
+ */
+long coalesced_lookups() {
+    return __atomic_load_n(&lookups_coalesced, __ATOMIC_RELAXED);
+}
+
+
 /*
 * Moves a file/directory from a path to another one.
 * Input:
 *   - from: current path of the file/directory to move
 *   - to: new path of this file/directory
+* Returns: SUCCESS or TECNICOFS_ERROR_* code
 */
 int move(char* from, char* to) {
 
     /* used to hold name while splitting string */
-    char name_copy_1[MAX_FILE_NAME], name_copy_2[MAX_FILE_NAME];
+    char name_copy_1[MAX_PATH_SIZE], name_copy_2[MAX_PATH_SIZE];
 
     /* from variables */
     int parent_from_inumber, child_from_inumber;
@@ -336,7 +529,7 @@ int move(char* from, char* to) {
     if ((sub_str = strstr(name_copy_2, name_copy_1)) != NULL && strcmp(sub_str, name_copy_2) == 0) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, can't move a dir inside itself\n", from);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
     /* checks which path is shorter and traverses that one first because, otherwise, it would
@@ -346,21 +539,26 @@ int move(char* from, char* to) {
      * this) or they are different and if so, it won't interfere with the process */
     if (strcmp(parent_from, parent_to) > 0) {
         parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, 0);
-        parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, 0);
+        parent_from_inumber = parent_to_inumber == EXPIRED ? EXPIRED : traverse_path(parent_from, locked_inumbers, &amount, 0);
     } else {
         parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, 0);
-        parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, 0);
+        parent_to_inumber = parent_from_inumber == EXPIRED ? EXPIRED : traverse_path(parent_to, locked_inumbers, &amount, 0);
+    }
+
+    if (parent_from_inumber == EXPIRED || parent_to_inumber == EXPIRED) {
+        unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+        return TECNICOFS_ERROR_TIMEOUT;
     }
 
     /* if we couldn't find it, returns an error */
     if (parent_from_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, invalid parent_from dir %s\n", from, parent_from);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     } else if (parent_to_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, invalid parent_to dir %s\n", from, parent_to);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     /* get both parents inodes information */
@@ -371,28 +569,31 @@ int move(char* from, char* to) {
     if (pType_from != T_DIRECTORY) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, parent_from %s is not a dir\n", from, parent_from);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
 
         /* if it wasn't a directory, we can't move anything to there, so we throw an error */
     } else if (pType_to != T_DIRECTORY) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, parent_to %s is not a dir\n", to, parent_to);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
     }
 
     /* tries to get child inumber. it can be 'FAIL' if not found */
     child_from_inumber = lookup_sub_node(child_from, pdata_from.dirEntries);
 
-    /* locks (write) the directory/file that will be moved */
-    assert__(lock_write(child_from_inumber) == SUCCESS, "Error: move failed to lock an inode!\n")
-    locked_inumbers[amount++] = child_from_inumber;
-
     /* if we couldn't find the node that is going to be moves, we show an error */
     if (child_from_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, child_from does not exist in dir %s\n", child_from, parent_from);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_NOT_FOUND;
+    }
+
+    /* locks (write) the directory/file that will be moved */
+    if (lock_write(child_from_inumber) == FAIL) {
+        unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+        return TECNICOFS_ERROR_TIMEOUT;
     }
+    locked_inumbers[amount++] = child_from_inumber;
 
     /* since we already have the child's inumber, we can get it's information */
     inode_get(child_from_inumber, &cType_from, &cdata_from);
@@ -404,14 +605,14 @@ int move(char* from, char* to) {
     if (child_to_inumber != FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s, child_to already exists in dir %s\n", child_to, parent_to);
-        return FAIL;
+        return TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
     }
 
     /* remove entry from folder that contained moved node */
     if (dir_reset_entry(parent_from_inumber, child_from_inumber) == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s from dir %s\n", child_from, parent_from);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
     /* adds removed node to the destiny directory */
@@ -419,9 +620,13 @@ int move(char* from, char* to) {
         dir_add_entry(parent_from_inumber, child_from_inumber, child_from);  /* if an error occurred, we have to add back the removed directory */
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not move entry %s in dir %s\n", child_from, parent_to);
-        return FAIL;
+        return TECNICOFS_ERROR_OTHER;
     }
 
+    /* records the change so that incremental prints can report it */
+    char normalized_from[MAX_PATH_SIZE], normalized_to[MAX_PATH_SIZE];
+    inode_log_change('m', T_NONE, normalize_path(from, normalized_from), normalize_path(to, normalized_to));
+
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
@@ -437,11 +642,12 @@ int move(char* from, char* to) {
  *  - is_lookup: 1 if operation is lookup() and 0 if it is not
  * Returns:
  *  - inumber: identifier of the i-node, if found
+ *  - EXPIRED: if the deadline of the thread passed while waiting for a lock
  *  - FAIL: otherwise
  */
 int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup) {
 
-    char full_path[MAX_FILE_NAME];
+    char full_path[MAX_PATH_SIZE];
     char delim[] = "/";
 
     strcpy(full_path, name);
@@ -460,8 +666,7 @@ int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup)
 
     /* puts root in locking queue if it isn't there already */
     if ( ! check_if_node_is_in_array(current_inumber, locked_inumbers, *amount)) {
-        if (path == NULL && ! is_lookup) lock_write(current_inumber);
-        else lock_read(current_inumber);
+        if ((path == NULL && ! is_lookup ? lock_write(current_inumber) : lock_read(current_inumber)) == FAIL) return EXPIRED;
         locked_inumbers[*amount] = current_inumber;
         *amount += 1;
     }
@@ -473,8 +678,7 @@ int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup)
     while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
         path = strtok_r(NULL, delim, &save_ptr);
         if ( ! check_if_node_is_in_array(current_inumber, locked_inumbers, *amount)) {
-            if (path == NULL && ! is_lookup) lock_write(current_inumber);
-            else lock_read(current_inumber);
+            if ((path == NULL && ! is_lookup ? lock_write(current_inumber) : lock_read(current_inumber)) == FAIL) return EXPIRED;
             locked_inumbers[*amount] = current_inumber;
             *amount += 1;
         }
@@ -485,28 +689,410 @@ int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup)
 
 
 /*
- * Prints tecnicofs tree.
+ * Lookup for a given path as seen in a snapshot. Doesn't lock any inode.
+ * Input:
+ *  - name: path of node
+ *  - snapshot: snapshot stamp (see snapshot_begin)
+ * Returns:
+ *  - inumber: identifier of the i-node, if found
+ *  - FAIL: otherwise
+ */
+int snapshot_traverse_path(char *name, long snapshot) {
+
+    char full_path[MAX_PATH_SIZE];
+    char delim[] = "/";
+
+    strcpy(full_path, name);
+
+    /* start at root node */
+    int current_inumber = FS_ROOT;
+
+    /* use for copy and to store data */
+    type nType;
+    union Data data;
+
+    /* used to make strtok_r thread safe */
+    char *save_ptr;
+
+    char *path = strtok_r(full_path, delim, &save_ptr);
+
+    if (inode_snapshot_get(current_inumber, snapshot, &nType, &data) == FAIL) return FAIL;
+
+    /* search for all sub nodes */
+    while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
+        if (inode_snapshot_get(current_inumber, snapshot, &nType, &data) == FAIL) return FAIL;
+        path = strtok_r(NULL, delim, &save_ptr);
+    }
+    return current_inumber;
+}
+
+
+/*
+ * Splits the dump into units until there are enough of them to keep all the workers busy. Units
+ * stay in the order their lines must be written.
+ * Input:
+ *  - amount: pointer that gets the number of units
+ *  - snapshot: snapshot stamp
+ * Returns:
+ *  - array of units
+ */
+print_unit *split_print_units(int *amount, long snapshot) {
+
+    print_unit *units = calloc(1, sizeof(print_unit));
+    assert__(units != NULL, "Error: split_print_units couldn't allocate units!\n")
+    units[0].inumber = FS_ROOT;
+    units[0].is_subtree = 1;
+    *amount = 1;
+
+    for (int depth = 0; depth < PRINT_SPLIT_DEPTH && *amount < PRINT_WORKERS * 4; depth++) {
+
+        /* each directory is replaced by its own line plus one unit per child */
+        print_unit *split = calloc(*amount * (MAX_DIR_ENTRIES + 1), sizeof(print_unit));
+        assert__(split != NULL, "Error: split_print_units couldn't allocate units!\n")
+        int split_amount = 0;
+
+        for (int i = 0; i < *amount; i++) {
+            type nType;
+            union Data data;
+
+            split[split_amount] = units[i];
+            if (! units[i].is_subtree || inode_snapshot_get(units[i].inumber, snapshot, &nType, &data) == FAIL
+                    || nType != T_DIRECTORY) {
+                split_amount++;
+                continue;
+            }
+
+            split[split_amount++].is_subtree = 0;
+            for (int j = 0; j < MAX_DIR_ENTRIES; j++) {
+                if (data.dirEntries[j].inumber == FREE_INODE) continue;
+
+                print_unit *child = &split[split_amount++];
+                child->inumber = data.dirEntries[j].inumber;
+                child->is_subtree = 1;
+                buffer_append(&child->path, units[i].path.data, units[i].path.size);
+                buffer_append(&child->path, "/", 1);
+                buffer_append(&child->path, data.dirEntries[j].name, strlen(data.dirEntries[j].name));
+            }
+        }
+
+        free(units);
+        units = split;
+        *amount = split_amount;
+    }
+
+    return units;
+}
+
+
+/*
+ * Dumps one unit of a print job into its buffer.
+ * Input:
+ *  - job: print job
+ *  - unit: unit to dump
+ */
+void print_unit_dump(print_job *job, print_unit *unit) {
+    if (unit->is_subtree) {
+        inode_print_tree(&unit->out, unit->inumber, &unit->path, job->snapshot);
+    } else {
+        buffer_append(&unit->out, unit->path.data, unit->path.size);
+        buffer_append(&unit->out, "\n", 1);
+    }
+
+    assert__(pthread_mutex_lock(&job->lock) == 0, "Error: print_unit_dump failed to lock!\n")
+    unit->done = 1;
+    pthread_cond_broadcast(&job->cond_done);
+    assert__(pthread_mutex_unlock(&job->lock) == 0, "Error: print_unit_dump failed to unlock!\n")
+}
+
+
+/*
+ * Removes a job from the open ones, if it is still there. The pool's lock must be held.
+ * Input:
+ *  - job: print job
+ */
+static void print_pool_close(print_job *job) {
+    for (print_job **open = &print_pool.open; *open != NULL; open = &(*open)->next_open) {
+        if (*open == job) {
+            *open = job->next_open;
+            return;
+        }
+    }
+}
+
+
+/*
+ * Dumps units of the open print jobs into their buffers, waiting for jobs when there are none.
+ * Never returns.
+ * Input:
+ *  - ptr: unused
+ */
+void *print_worker(void *ptr) {
+    int i;
+
+    assert__(pthread_mutex_lock(&print_pool.lock) == 0, "Error: print_worker failed to lock!\n")
+    while (1) {
+        while (print_pool.open == NULL) pthread_cond_wait(&print_pool.cond_open, &print_pool.lock);
+        print_job *job = print_pool.open;
+        job->helpers++;
+        assert__(pthread_mutex_unlock(&print_pool.lock) == 0, "Error: print_worker failed to unlock!\n")
+
+        while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->amount)
+            print_unit_dump(job, &job->units[i]);
+
+        /* every unit is claimed, so other workers have nothing to do in this job */
+        assert__(pthread_mutex_lock(&print_pool.lock) == 0, "Error: print_worker failed to lock!\n")
+        print_pool_close(job);
+        if (--job->helpers == 0) pthread_cond_broadcast(&print_pool.cond_left);
+    }
+    return NULL;
+}
+
+
+/*
+ * Starts the print workers. Called once.
+ */
+static void print_pool_start() {
+    for (int i = 0; i < PRINT_WORKERS - 1; i++) {
+        pthread_t worker;
+        assert__(pthread_create(&worker, NULL, print_worker, NULL) == 0, "Error: couldn't create a print worker!\n")
+        pthread_detach(worker);
+    }
+}
+
+
+/*
+ * Writes the contents of all the units to a file, in order, using as few system calls as possible.
+ * Input:
+ *  - fd: file descriptor
+ *  - units: units of a finished print job
+ *  - amount: number of units
+ * Returns: SUCCESS or FAIL
+ */
+int write_print_units(int fd, print_unit *units, int amount) {
+    struct iovec iov[PRINT_IOV_SIZE];
+    int i = 0;
+
+    while (i < amount) {
+        int count = 0;
+        for (; i < amount && count < PRINT_IOV_SIZE; i++) {
+            if (units[i].out.size == 0) continue;
+            iov[count].iov_base = units[i].out.data;
+            iov[count++].iov_len = units[i].out.size;
+        }
+
+        /* writev may stop in the middle of a buffer, so we continue from where it did */
+        struct iovec *pending = iov;
+        while (count > 0) {
+            ssize_t written = writev(fd, pending, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return FAIL;
+            }
+            while (count > 0 && (size_t) written >= pending->iov_len) {
+                written -= (ssize_t) pending->iov_len;
+                pending++;
+                count--;
+            }
+            if (count > 0) {
+                pending->iov_base = (char *) pending->iov_base + written;
+                pending->iov_len -= written;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Writes the whole contents of a buffer to a file.
+ * Input:
+ *  - fd: file descriptor
+ *  - buffer: buffer to write
+ * Returns: SUCCESS or FAIL
+ */
+int write_buffer(int fd, out_buffer *buffer) {
+    size_t done = 0;
+    while (done < buffer->size) {
+        ssize_t written = write(fd, buffer->data + done, buffer->size - done);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return FAIL;
+        }
+        done += written;
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Sink that writes dumped units to a file.
+ * Input:
+ *  - ptr: pointer to the file descriptor
+ *  - units: units to write
+ *  - amount: number of units
+ * Returns: SUCCESS or FAIL
+ */
+int print_file_sink(void *ptr, print_unit *units, int amount) {
+    return write_print_units(*(int *) ptr, units, amount);
+}
+
+
+/*
+ * Dumps the tree as seen in a snapshot. Subtrees are dumped in parallel, by this thread and the
+ * print workers, into memory and handed to the sink in order, as soon as all the ones before them are done, so the sink can start
+ * consuming the dump before it is over.
+ * Input:
+ *  - snapshot: snapshot stamp. must be held by the caller until this returns
+ *  - sink: function that consumes the dumped units
+ *  - arg: argument passed to the sink
+ * Output:
+ *  - SUCCESS or FAIL (if the sink failed, which stops the dump)
+ */
+int dump_tecnicofs_tree(long snapshot, print_sink sink, void *arg) {
+    print_job job;
+    job.snapshot = snapshot;
+    job.units = split_print_units(&job.amount, job.snapshot);
+    job.next = 0;
+    assert__(pthread_mutex_init(&job.lock, NULL) == 0, "Error: couldn't init print lock!\n")
+    assert__(pthread_cond_init(&job.cond_done, NULL) == 0, "Error: couldn't init print condition!\n")
+
+    job.helpers = 0;
+
+    /* workers rely on the caller's snapshot to keep the versions they read alive. small trees
+     * aren't worth waking them */
+    if (job.amount > PRINT_INLINE_UNITS) {
+        pthread_once(&print_pool_once, print_pool_start);
+        assert__(pthread_mutex_lock(&print_pool.lock) == 0, "Error: dump_tecnicofs_tree failed to lock!\n")
+        job.next_open = print_pool.open;
+        print_pool.open = &job;
+        pthread_cond_broadcast(&print_pool.cond_open);
+        assert__(pthread_mutex_unlock(&print_pool.lock) == 0, "Error: dump_tecnicofs_tree failed to unlock!\n")
+    }
+
+    /* this thread dumps units too and, between them, flushes the finished ones to the sink */
+    int res = SUCCESS, flushed = 0, i;
+    while (flushed < job.amount) {
+        if ((i = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED)) < job.amount)
+            print_unit_dump(&job, &job.units[i]);
+
+        assert__(pthread_mutex_lock(&job.lock) == 0, "Error: dump_tecnicofs_tree failed to lock!\n")
+        if (i >= job.amount)
+            while (! job.units[flushed].done) pthread_cond_wait(&job.cond_done, &job.lock);
+        int ready = flushed;
+        while (ready < job.amount && job.units[ready].done) ready++;
+        assert__(pthread_mutex_unlock(&job.lock) == 0, "Error: dump_tecnicofs_tree failed to unlock!\n")
+
+        if (ready == flushed) continue;
+        if (res == SUCCESS && (res = sink(arg, job.units + flushed, ready - flushed)) != SUCCESS) {
+            /* nobody takes the rest of the dump, so the units no thread started are skipped and
+             * the snapshot is let go as soon as the ones in progress are over */
+            int skipped = __atomic_exchange_n(&job.next, job.amount, __ATOMIC_RELAXED);
+            assert__(pthread_mutex_lock(&job.lock) == 0, "Error: dump_tecnicofs_tree failed to lock!\n")
+            for (; skipped < job.amount; skipped++) job.units[skipped].done = 1;
+            assert__(pthread_mutex_unlock(&job.lock) == 0, "Error: dump_tecnicofs_tree failed to unlock!\n")
+        }
+        for (; flushed < ready; flushed++) {
+            buffer_free(&job.units[flushed].path);
+            buffer_free(&job.units[flushed].out);
+        }
+    }
+
+    /* the job lives on this stack, so workers must have left it */
+    if (job.amount > PRINT_INLINE_UNITS) {
+        assert__(pthread_mutex_lock(&print_pool.lock) == 0, "Error: dump_tecnicofs_tree failed to lock!\n")
+        print_pool_close(&job);
+        while (job.helpers > 0) pthread_cond_wait(&print_pool.cond_left, &print_pool.lock);
+        assert__(pthread_mutex_unlock(&print_pool.lock) == 0, "Error: dump_tecnicofs_tree failed to unlock!\n")
+    }
+
+    pthread_cond_destroy(&job.cond_done);
+    pthread_mutex_destroy(&job.lock);
+    free(job.units);
+
+    return res;
+}
+
+
+/*
+ * Prints tecnicofs tree. Reads from a snapshot, so it doesn't stop other operations.
  * Input:
  *  - output_file_path: output file path
  * Output:
- *  - SUCCESS or error
+ *  - SUCCESS or TECNICOFS_ERROR_OTHER
  */
 int print_tecnicofs_tree(char* output_file_path) {
-    FILE *out = fopen(output_file_path, "w");
-    assert__(out != NULL, "Error: print_tecnico_tree couldn't open output file!\n")
-    inode_print_tree(out, FS_ROOT, "");
-    fclose(out);
+    int fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        printf("failed to print to %s, couldn't open output file\n", output_file_path);
+        return TECNICOFS_ERROR_OTHER;
+    }
+
+    long snapshot = snapshot_begin();
+    int res = dump_tecnicofs_tree(snapshot, print_file_sink, &fd);
+    snapshot_end();
+
+    close(fd);
+    return res == SUCCESS ? SUCCESS : TECNICOFS_ERROR_OTHER;
+}
+
+
+/*
+ * Prints the changes made to tecnicofs since an earlier print of changes, as create, delete and
+ * move commands. The first line holds the sequence number of this print ("# changes <seq> since
+ * <since>"). If the changes are no longer in the log, the whole tree is printed instead, under
+ * the line "# full <seq>". Sequence numbers are commit stamps, so they are kept in 64 bits like
+ * the commit clock and never mistaken for error codes.
+ * Input:
+ *  - output_file_path: output file path
+ *  - since: sequence number of an earlier print. a negative number asks for a full print
+ *  - seq: gets the sequence number of this print
+ * Output:
+ *  - SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int print_tecnicofs_changes(char* output_file_path, int64_t since, int64_t *seq) {
+    int fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        printf("failed to print changes to %s, couldn't open output file\n", output_file_path);
+        return TECNICOFS_ERROR_OTHER;
+    }
+
+    long snapshot = snapshot_begin();
+    out_buffer out = { NULL, 0, 0 };
+    char header[64];
+    int res;
+
+    int size = snprintf(header, sizeof(header), "# changes %ld since %" PRId64 "\n", snapshot, since);
+    buffer_append(&out, header, size);
+
+    if (since >= 0 && since <= snapshot && change_log_dump(&out, since, snapshot) == SUCCESS) {
+        res = write_buffer(fd, &out);
+    } else {
+        out.size = 0;
+        size = snprintf(header, sizeof(header), "# full %ld\n", snapshot);
+        buffer_append(&out, header, size);
+        res = write_buffer(fd, &out) == SUCCESS ? dump_tecnicofs_tree(snapshot, print_file_sink, &fd) : FAIL;
+    }
+
+    snapshot_end();
+    buffer_free(&out);
+    close(fd);
+
+    if (res != SUCCESS) return TECNICOFS_ERROR_OTHER;
+    *seq = snapshot;
     return SUCCESS;
 }
 
 
 /*
- * Unlocks all the locked inodes inside the array.
+ * Commits the changes of the operation and unlocks all the locked inodes inside the array.
  * Input:
  *   - locked_inumbers: array which holds all the inumbers of the locked nodes
  *   - amount: number of locks used
  * */
 void unlock_inodes(const int locked_inumbers[MAX_PATH_INODE_LENGTH], int amount) {
+    /* changes must be published while the inodes are still locked so that no other writer can
+     * stage a version on top of ours before it gets its stamp */
+    inode_commit();
     for(int i = 0; i < amount; i++) {
         assert__(unlock(locked_inumbers[i]) == SUCCESS, "Error: unlock_inodes failed to unlock a node!\n")
     }
@@ -1,16 +1,48 @@
 #ifndef FS_H
 #define FS_H
+#include <stdint.h>
 #include "state.h"
 
+/* maximum number of threads used to dump the tree */
+#define PRINT_WORKERS 4
+
+/* number of tree levels that can be split to share a dump between workers */
+#define PRINT_SPLIT_DEPTH 3
+
+/* maximum number of buffers written by each writev call (IOV_MAX on linux) */
+#define PRINT_IOV_SIZE 1024
+
+/* buckets of the table of lookups in flight, each one with its own lock */
+#define LOOKUP_FLIGHT_BUCKETS 64
+
+/*
+ * Piece of a tree dump. It is either a whole subtree or, for directories whose children were
+ * given their own units, just the directory's line
+ */
+typedef struct print_unit {
+    int inumber;
+    int is_subtree;
+    int done;  /* set once the unit has been dumped into out */
+    out_buffer path;
+    out_buffer out;
+} print_unit;
+
+/* consumes dumped units, in order. returns SUCCESS or FAIL */
+typedef int (*print_sink)(void *arg, print_unit *units, int amount);
+
 void init_fs();
 void destroy_fs();
 int is_dir_empty(DirEntry *dirEntries);
 int create(char *name, type nodeType);
 int delete(char *name);
 int lookup(char *name);
+long coalesced_lookups();
 int move(char *from, char *to);
 int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup);
+int snapshot_traverse_path(char *name, long snapshot);
+int dump_tecnicofs_tree(long snapshot, print_sink sink, void *arg);
 int print_tecnicofs_tree(char* output_file_path);
+int print_tecnicofs_changes(char* output_file_path, int64_t since, int64_t *seq);
 void unlock_inodes(const int locked_inumbers[MAX_PATH_INODE_LENGTH], int amount);
 
 #endif /* FS_H */
@@ -1,11 +1,66 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "state.h"
+#include "namespace.h"
+#include "arena.h"
 
 
-/* table that has all inodes */
-inode_t inode_table[INODE_TABLE_SIZE];
+/* table that has all inodes, mapped from an arena */
+inode_t *inode_table;
+
+/* versions and directory entries, packed in arenas so walking a path touches few pages */
+static slab_cache version_cache;
+static slab_cache entries_cache;
+
+/* stamp of the last committed operation. readers use it as their snapshot */
+long commit_clock = 0;
+
+/* serializes commits so that stamps are published in increasing order */
+pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* inodes with versions staged by the current thread that haven't been committed yet */
+static __thread int staged_inumbers[MAX_PATH_INODE_LENGTH];
+static __thread int staged_amount = 0;
+
+/* change made by the current thread's operation, logged when it's committed (op 0 if none) */
+static __thread change_record staged_change;
+
+/* ring with the last CHANGE_LOG_SIZE changes. protected by commit_lock */
+static change_record change_log[CHANGE_LOG_SIZE];
+static long change_log_count = 0;
+
+/* stamp of the newest change that was dropped from the log */
+static long change_log_floor = 0;
+
+/*
+ * Snapshot currently in use by a thread. A thread claims a slot the first time it takes a
+ * snapshot and gives it back when it exits, so the list only grows up to the most threads alive
+ * at once. Slots are never unlinked, since commits walk the list without locking
+ */
+typedef struct reader_slot {
+    long snapshot;
+    int claimed;
+    struct reader_slot *next;
+} reader_slot;
+
+static reader_slot *reader_slots = NULL;
+static pthread_mutex_t reader_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread reader_slot *thread_slot = NULL;
+
+/* key whose destructor gives a thread's reader slot back when it exits */
+static pthread_key_t reader_slot_key;
+static pthread_once_t reader_slot_key_once = PTHREAD_ONCE_INIT;
+
+/* what this thread does while an i-node lock is busy (NULL to block on the lock) */
+static __thread lock_wait_fn lock_wait = NULL;
+
+/* CLOCK_MONOTONIC time after which this thread gives up on busy locks (tv_sec < 0 for never) */
+static __thread struct timespec lock_deadline = { -1, 0 };
+
+/* nanoseconds threads spent blocked on i-node locks, summed over every thread */
+static long lock_wait_total = 0;
 
 
 /*
@@ -17,13 +72,22 @@ void insert_delay(int cycles) {
 
 
 /*
- * Initializes the i-nodes table.
+ * Initializes the i-nodes table. The table and the caches of versions and directory entries are
+ * mapped with the pages chosen by arena_set_pages.
  */
 void inode_table_init() {
+    inode_table = arena_map(sizeof(inode_t) * INODE_TABLE_SIZE);
+    assert__(inode_table != NULL, "Error: inode_table_init couldn't map the i-node table!\n")
+    assert__(slab_init(&version_cache, sizeof(inode_version)) == SUCCESS
+             && slab_init(&entries_cache, sizeof(DirEntry) * MAX_DIR_ENTRIES) == SUCCESS,
+             "Error: inode_table_init couldn't set up its caches!\n")
+
     for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        assert__(pthread_rwlock_init(&inode_table[i].lock, NULL) == 0, "Error: inode_table_init failed to create a lock!\n")
         inode_table[i].nodeType = T_NONE;
         inode_table[i].data.dirEntries = NULL;
         inode_table[i].data.fileContents = NULL;
+        inode_table[i].version = NULL;
     }
 }
 
@@ -32,14 +96,368 @@ void inode_table_init() {
  * Releases the allocated memory for the i-nodes tables.
  */
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	        if (inode_table[i].data.dirEntries)
-                free(inode_table[i].data.dirEntries);
+    /* versions and directory contents live in the arenas of their caches, so unmapping those
+     * releases them all at once */
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) pthread_rwlock_destroy(&inode_table[i].lock);
+    slab_destroy(&version_cache);
+    slab_destroy(&entries_cache);
+    arena_unmap(inode_table, sizeof(inode_t) * INODE_TABLE_SIZE);
+    inode_table = NULL;
+
+    for (int i = 0; i < CHANGE_LOG_SIZE; i++) {
+        free(change_log[i].path);
+        free(change_log[i].path_to);
+        change_log[i].path = change_log[i].path_to = NULL;
+    }
+
+    /* reader slots are kept, since threads still alive point at theirs and give them back when
+     * they exit */
+}
+
+
+/*
+ * Makes sure the newest version of an i-node was staged by the current thread, copying the last
+ * committed one if needed. Staged versions are invisible to readers until inode_commit is called.
+ * The caller must hold the i-node's write lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - copy_entries: 0 if the directory contents won't be needed, so they aren't copied
+ * Returns:
+ *  - staged version of the i-node
+ */
+static inode_version *inode_stage_version(int inumber, int copy_entries) {
+    inode_version *head = inode_table[inumber].version;
+
+    /* only the holder of the write lock can stage, so a pending head is always ours */
+    if (head != NULL && head->stamp == PENDING_STAMP) return head;
+
+    inode_version *version = slab_alloc(&version_cache);
+    assert__(version != NULL, "Error: inode_stage couldn't allocate a version!\n")
+    assert__(staged_amount < MAX_PATH_INODE_LENGTH, "Error: inode_stage has too many staged inodes!\n")
+
+    version->stamp = PENDING_STAMP;
+    version->nodeType = inode_table[inumber].nodeType;
+    version->dirEntries = NULL;
+    version->prev = head;
+
+    /* committed versions are never modified, so directory contents are copied on write */
+    if (copy_entries && head != NULL && head->dirEntries != NULL) {
+        version->dirEntries = slab_alloc(&entries_cache);
+        assert__(version->dirEntries != NULL, "Error: inode_stage couldn't allocate entries!\n")
+        memcpy(version->dirEntries, head->dirEntries, sizeof(DirEntry) * MAX_DIR_ENTRIES);
+    }
+
+    __atomic_store_n(&inode_table[inumber].version, version, __ATOMIC_RELEASE);
+    inode_table[inumber].data.dirEntries = version->dirEntries;
+    staged_inumbers[staged_amount++] = inumber;
+
+    return version;
+}
+
+
+/*
+ * Stages the newest version of an i-node, as inode_stage_version.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns:
+ *  - staged version of the i-node, with a copy of its directory contents
+ */
+static inode_version *inode_stage(int inumber) {
+    return inode_stage_version(inumber, 1);
+}
+
+
+/*
+ * Stages a tombstone for an i-node. Its contents stay in the previous version for readers still
+ * looking at it, so nothing is copied.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns:
+ *  - staged version of the i-node, of type T_NONE
+ */
+static inode_version *inode_stage_tombstone(int inumber) {
+    inode_version *version = inode_stage_version(inumber, 0);
+
+    /* only set if the operation had staged the i-node before deleting it */
+    slab_free(&entries_cache, version->dirEntries);
+    version->nodeType = T_NONE;
+    version->dirEntries = NULL;
+    return version;
+}
+
+
+/*
+ * Releases the versions of an i-node that can no longer be seen by any reader.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - oldest: oldest snapshot still in use
+ */
+static void inode_prune(int inumber, long oldest) {
+    inode_version *keep = inode_table[inumber].version;
+
+    /* the first version visible in the oldest snapshot is the last one anyone can reach */
+    while (keep != NULL && keep->stamp > oldest) keep = keep->prev;
+    if (keep == NULL) return;
+
+    inode_version *version = keep->prev;
+    keep->prev = NULL;
+    while (version != NULL) {
+        inode_version *prev = version->prev;
+        slab_free(&entries_cache, version->dirEntries);
+        slab_free(&version_cache, version);
+        version = prev;
+    }
+}
+
+
+/*
+ * Gets the oldest snapshot that may still be in use by a reader.
+ * Input:
+ *  - clock: last committed stamp
+ * Returns:
+ *  - oldest snapshot
+ */
+static long oldest_snapshot(long clock) {
+    long oldest = clock;
+    for (reader_slot *slot = __atomic_load_n(&reader_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        long snapshot = __atomic_load_n(&slot->snapshot, __ATOMIC_SEQ_CST);
+        if (snapshot != NO_SNAPSHOT && snapshot < oldest) oldest = snapshot;
+    }
+    return oldest;
+}
+
+
+/*
+ * Publishes every version staged by the current thread under a new commit stamp, so that all
+ * the changes made by one operation become visible to readers at once.
+ * Returns:
+ *  - stamp of the commit (or the current one if nothing was staged)
+ */
+long inode_commit() {
+    if (staged_amount == 0) {
+        /* an operation that changed nothing has nothing to log either */
+        free(staged_change.path);
+        free(staged_change.path_to);
+        staged_change.op = 0;
+        staged_change.path = staged_change.path_to = NULL;
+        return __atomic_load_n(&commit_clock, __ATOMIC_ACQUIRE);
+    }
+
+    assert__(pthread_mutex_lock(&commit_lock) == 0, "Error: inode_commit failed to lock!\n")
+
+    /* the namespace mirror changes in the same critical section, so it goes through the same
+     * states as the snapshots */
+    long stamp = commit_clock + 1;
+    namespace_begin();
+    for (int i = 0; i < staged_amount; i++) {
+        __atomic_store_n(&inode_table[staged_inumbers[i]].version->stamp, stamp, __ATOMIC_RELEASE);
+        namespace_publish(staged_inumbers[i], inode_table[staged_inumbers[i]].version);
+    }
+    namespace_end();
+
+    /* the change is logged in the same critical section so the log is ordered by stamp and
+     * holds every change up to the clock seen by readers */
+    if (staged_change.op != 0) {
+        change_record *record = &change_log[change_log_count++ % CHANGE_LOG_SIZE];
+        if (record->path != NULL) change_log_floor = record->stamp;
+        free(record->path);
+        free(record->path_to);
+
+        *record = staged_change;
+        record->stamp = stamp;
+        staged_change.op = 0;
+        staged_change.path = staged_change.path_to = NULL;
+    }
+
+    __atomic_store_n(&commit_clock, stamp, __ATOMIC_SEQ_CST);
+
+    /* old versions are only collected when their inode changes, which keeps commits O(changes) */
+    long oldest = oldest_snapshot(stamp);
+    for (int i = 0; i < staged_amount; i++)
+        inode_prune(staged_inumbers[i], oldest);
+
+    assert__(pthread_mutex_unlock(&commit_lock) == 0, "Error: inode_commit failed to unlock!\n")
+
+    staged_amount = 0;
+    return stamp;
+}
+
+
+/*
+ * Records the change made by the current operation. It is added to the change log when the
+ * operation is committed.
+ * Input:
+ *  - op: 'c' (create), 'd' (delete) or 'm' (move)
+ *  - nodeType: type of the created node
+ *  - path: path of the node
+ *  - path_to: new path of the node (moves only)
+ */
+void inode_log_change(char op, type nodeType, char *path, char *path_to) {
+    free(staged_change.path);
+    free(staged_change.path_to);
+
+    staged_change.op = op;
+    staged_change.nodeType = nodeType;
+    staged_change.path = strdup(path);
+    staged_change.path_to = path_to ? strdup(path_to) : NULL;
+    assert__(staged_change.path != NULL, "Error: inode_log_change couldn't copy path!\n")
+}
+
+
+/*
+ * Writes the changes committed after a given stamp, one per line, in the same format as the
+ * input commands.
+ * Input:
+ *  - out: buffer where the lines are appended
+ *  - since: changes with this stamp or older are skipped
+ *  - until: changes newer than this stamp are skipped
+ * Returns:
+ *  - SUCCESS
+ *  - FAIL: if some change after since was already dropped from the log
+ */
+int change_log_dump(out_buffer *out, long since, long until) {
+    int res = SUCCESS;
+
+    assert__(pthread_mutex_lock(&commit_lock) == 0, "Error: change_log_dump failed to lock!\n")
+
+    if (since < change_log_floor) {
+        res = FAIL;
+    } else {
+        long first = change_log_count > CHANGE_LOG_SIZE ? change_log_count - CHANGE_LOG_SIZE : 0;
+        for (long i = first; i < change_log_count; i++) {
+            change_record *record = &change_log[i % CHANGE_LOG_SIZE];
+            if (record->stamp <= since || record->stamp > until) continue;
+
+            buffer_append(out, &record->op, 1);
+            buffer_append(out, " ", 1);
+            buffer_append(out, record->path, strlen(record->path));
+            if (record->op == 'c') {
+                buffer_append(out, record->nodeType == T_DIRECTORY ? " d" : " f", 2);
+            } else if (record->op == 'm') {
+                buffer_append(out, " ", 1);
+                buffer_append(out, record->path_to, strlen(record->path_to));
+            }
+            buffer_append(out, "\n", 1);
         }
     }
+
+    assert__(pthread_mutex_unlock(&commit_lock) == 0, "Error: change_log_dump failed to unlock!\n")
+
+    return res;
+}
+
+
+/*
+ * Destructor of reader_slot_key: gives the reader slot of an exiting thread back.
+ * Input:
+ *  - ptr: slot of the thread
+ */
+static void reader_slot_release(void *ptr) {
+    reader_slot *slot = ptr;
+    __atomic_store_n(&slot->snapshot, NO_SNAPSHOT, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->claimed, 0, __ATOMIC_RELEASE);
+}
+
+
+static void reader_slot_key_create() {
+    assert__(pthread_key_create(&reader_slot_key, reader_slot_release) == 0, "Error: couldn't create the reader slot key!\n")
+}
+
+
+/*
+ * Claims a reader slot for the current thread, reusing one left by a thread that exited before
+ * adding a new one.
+ * Returns:
+ *  - slot of the thread
+ */
+static reader_slot *reader_slot_claim() {
+    pthread_once(&reader_slot_key_once, reader_slot_key_create);
+
+    reader_slot *slot;
+    for (slot = __atomic_load_n(&reader_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        int unclaimed = 0;
+        if (__atomic_compare_exchange_n(&slot->claimed, &unclaimed, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+
+    if (slot == NULL) {
+        slot = malloc(sizeof(reader_slot));
+        assert__(slot != NULL, "Error: snapshot_begin couldn't allocate a reader slot!\n")
+        slot->snapshot = NO_SNAPSHOT;
+        slot->claimed = 1;
+
+        assert__(pthread_mutex_lock(&reader_slots_lock) == 0, "Error: snapshot_begin failed to lock!\n")
+        slot->next = reader_slots;
+        __atomic_store_n(&reader_slots, slot, __ATOMIC_RELEASE);
+        assert__(pthread_mutex_unlock(&reader_slots_lock) == 0, "Error: snapshot_begin failed to unlock!\n")
+    }
+
+    pthread_setspecific(reader_slot_key, slot);
+    return slot;
+}
+
+
+/*
+ * Starts a read-only snapshot of the file system. Versions visible in it are kept alive until
+ * snapshot_end is called. A thread can only be inside one snapshot at a time.
+ * Returns:
+ *  - snapshot stamp
+ */
+long snapshot_begin() {
+    if (thread_slot == NULL) thread_slot = reader_slot_claim();
+
+    /* the snapshot only counts once the clock is seen unchanged after publishing it, otherwise a
+     * concurrent commit could have missed our slot and released versions we are about to read */
+    long snapshot;
+    do {
+        snapshot = __atomic_load_n(&commit_clock, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&thread_slot->snapshot, snapshot, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&commit_clock, __ATOMIC_SEQ_CST) != snapshot);
+
+    return snapshot;
+}
+
+
+/*
+ * Returns: stamp of the last commit, which a snapshot taken now would see
+ */
+long commit_clock_now() {
+    return __atomic_load_n(&commit_clock, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Ends the snapshot of the current thread.
+ */
+void snapshot_end() {
+    if (thread_slot != NULL) __atomic_store_n(&thread_slot->snapshot, NO_SNAPSHOT, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Copies the contents of the i-node as seen in a snapshot into the arguments. Doesn't lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - snapshot: snapshot stamp
+ *  - nType: pointer to type
+ *  - data: pointer to data
+ * Returns: SUCCESS or FAIL
+ */
+int inode_snapshot_get(int inumber, long snapshot, type *nType, union Data *data) {
+    /* Used for testing synchronization speedup */
+    insert_delay(DELAY);
+
+    if ((inumber < 0) || (inumber >= INODE_TABLE_SIZE)) return FAIL;
+
+    inode_version *version = __atomic_load_n(&inode_table[inumber].version, __ATOMIC_ACQUIRE);
+    while (version != NULL && __atomic_load_n(&version->stamp, __ATOMIC_ACQUIRE) > snapshot)
+        version = version->prev;
+
+    if (version == NULL || version->nodeType == T_NONE) return FAIL;
+
+    if (nType) *nType = version->nodeType;
+    if (data) data->dirEntries = version->dirEntries;
+
+    return SUCCESS;
 }
 
 
@@ -67,13 +485,18 @@ int inode_create(type nType) {
         if (inode_table[inumber].nodeType == T_NONE) {
             inode_table[inumber].nodeType = nType;
 
+            inode_version *version = inode_stage(inumber);
+            version->nodeType = nType;
+
             if (nType == T_DIRECTORY) {
                 /* Initializes entry table */
-                inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-                
+                version->dirEntries = slab_alloc(&entries_cache);
+                assert__(version->dirEntries != NULL, "Error: inode_create couldn't allocate entries!\n")
+
                 for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
+                    version->dirEntries[i].inumber = FREE_INODE;
                 }
+                inode_table[inumber].data.dirEntries = version->dirEntries;
             }
             else {
                 inode_table[inumber].data.fileContents = NULL;
@@ -104,11 +527,12 @@ int inode_delete(int inumber) {
         return FAIL;
     } 
 
+    /* the contents stay in the previous version for readers still looking at it. the inode is
+     * unlocked by the caller once the deletion has been committed */
+    inode_stage_tombstone(inumber);
+
     inode_table[inumber].nodeType = T_NONE;
-    unlock(inumber);
-    /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    inode_table[inumber].data.dirEntries = NULL;
     return SUCCESS;
 }
 
@@ -165,10 +589,12 @@ int dir_reset_entry(int inumber, int sub_inumber) {
         return FAIL;
     }
 
+    DirEntry *entries = inode_stage(inumber)->dirEntries;
+
     for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
+        if (entries[i].inumber == sub_inumber) {
+            entries[i].inumber = FREE_INODE;
+            entries[i].name[0] = '\0';
             return SUCCESS;
         }
     }
@@ -209,11 +635,18 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
         printf("inode_add_entry: entry name must be non-empty\n");
         return FAIL;
     }
+
+    if (strlen(sub_name) >= MAX_FILE_NAME) {
+        printf("inode_add_entry: entry name must be shorter than %d\n", MAX_FILE_NAME);
+        return FAIL;
+    }
     
+    DirEntry *entries = inode_stage(inumber)->dirEntries;
+
     for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
+        if (entries[i].inumber == FREE_INODE) {
+            entries[i].inumber = sub_inumber;
+            strcpy(entries[i].name, sub_name);
             return SUCCESS;
         }
     }
@@ -222,62 +655,212 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
 
 
 /*
- * Prints the i-nodes table.
+ * Appends bytes to a buffer, growing it when needed.
  * Input:
+ *  - buffer: buffer to append to
+ *  - bytes: bytes to append
+ *  - size: number of bytes
+ */
+void buffer_append(out_buffer *buffer, const char *bytes, size_t size) {
+    if (size == 0) return;
+
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : BUFFER_INITIAL_SIZE;
+        while (capacity < buffer->size + size) capacity *= 2;
+
+        buffer->data = realloc(buffer->data, capacity);
+        assert__(buffer->data != NULL, "Error: buffer_append couldn't grow buffer!\n")
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+}
+
+
+/*
+ * Releases the memory held by a buffer and empties it.
+ * Input:
+ *  - buffer: buffer to release
+ */
+void buffer_free(out_buffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = buffer->capacity = 0;
+}
+
+
+/*
+ * Prints the i-nodes table as seen in a snapshot, one path per line.
+ * Input:
+ *  - out: buffer where the lines are appended
  *  - inumber: identifier of the i-node
- *  - name: pointer to the name of current file/dir
+ *  - path: path of current file/dir. it is extended while visiting children and restored after
+ *  - snapshot: snapshot stamp
  */
-void inode_print_tree(FILE *fp, int inumber, char *name) {
-    if (inode_table[inumber].nodeType == T_FILE) {
-        fprintf(fp, "%s\n", name);
-        return;
-    }
-
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
-        fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
-            }
+void inode_print_tree(out_buffer *out, int inumber, out_buffer *path, long snapshot) {
+    type nType;
+    union Data data;
+
+    if (inode_snapshot_get(inumber, snapshot, &nType, &data) == FAIL) return;
+
+    buffer_append(out, path->data, path->size);
+    buffer_append(out, "\n", 1);
+
+    if (nType != T_DIRECTORY) return;
+
+    size_t path_size = path->size;
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (data.dirEntries[i].inumber != FREE_INODE) {
+            buffer_append(path, "/", 1);
+            buffer_append(path, data.dirEntries[i].name, strlen(data.dirEntries[i].name));
+            inode_print_tree(out, data.dirEntries[i].inumber, path, snapshot);
+            path->size = path_size;
         }
     }
 }
 
 
+/*
+ * Returns:
+ *   - 1 if this thread has a deadline and it has passed, 0 otherwise
+ * */
+static int lock_deadline_passed() {
+    if (lock_deadline.tv_sec < 0) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > lock_deadline.tv_sec || (now.tv_sec == lock_deadline.tv_sec && now.tv_nsec >= lock_deadline.tv_nsec);
+}
+
+
+/*
+ * Gets the deadline of this thread on the clock used by timed locks, which is CLOCK_REALTIME.
+ * Input:
+ *   - abstime: gets the deadline
+ * */
+static void lock_deadline_realtime(struct timespec *abstime) {
+    struct timespec now_mono;
+    clock_gettime(CLOCK_MONOTONIC, &now_mono);
+    clock_gettime(CLOCK_REALTIME, abstime);
+
+    long left = (lock_deadline.tv_sec - now_mono.tv_sec) * 1000000000L + lock_deadline.tv_nsec - now_mono.tv_nsec;
+    abstime->tv_sec += left / 1000000000L;
+    abstime->tv_nsec += left % 1000000000L;
+    if (abstime->tv_nsec >= 1000000000L) {
+        abstime->tv_sec++;
+        abstime->tv_nsec -= 1000000000L;
+    }
+    else if (abstime->tv_nsec < 0) {
+        abstime->tv_sec--;
+        abstime->tv_nsec += 1000000000L;
+    }
+}
+
+
+/*
+ * Adds the time since a lock was found busy to the time spent blocked on locks.
+ * Input:
+ *   - start: when the lock was found busy
+ * */
+static void lock_wait_add(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __atomic_add_fetch(&lock_wait_total, (end.tv_sec - start->tv_sec) * 1000000000L + end.tv_nsec - start->tv_nsec, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Returns:
+ *   - nanoseconds threads spent blocked on i-node locks since the start, summed over every thread
+ * */
+long lock_wait_time() {
+    return __atomic_load_n(&lock_wait_total, __ATOMIC_RELAXED);
+}
+
+
 /*
  * Locks inode with given inumber for reading.
+ * Threads given a lock wait function keep trying it instead, see set_lock_wait.
  * Input:
  *   - inumber: integer corresponding to an inode id
  * Return:
- *   - FAIL: if locking was unsuccessful
+ *   - FAIL: if locking was unsuccessful or the deadline of the thread passed first
  *   - SUCCESS: if locking was successful
  * */
 int lock_read(int inumber) {
+    /* work for a client that stopped waiting isn't started */
+    if (lock_deadline_passed()) return FAIL;
+
+    if (lock_wait != NULL) {
+        while (pthread_rwlock_tryrdlock(&inode_table[inumber].lock) != 0) {
+            if (lock_deadline_passed()) return FAIL;
+            lock_wait();
+        }
+        return SUCCESS;
+    }
+
+    /* only locks that are busy are timed, so uncontended ones cost nothing more */
+    if (pthread_rwlock_tryrdlock(&inode_table[inumber].lock) == 0) return SUCCESS;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (lock_deadline.tv_sec >= 0) {
+        struct timespec abstime;
+        lock_deadline_realtime(&abstime);
+        int res = pthread_rwlock_timedrdlock(&inode_table[inumber].lock, &abstime);
+        lock_wait_add(&start);
+        return res == 0 ? SUCCESS : FAIL;
+    }
+
     if (pthread_rwlock_rdlock(&inode_table[inumber].lock) != 0) {
         fprintf(stderr, "Error: failed to lock (read) inode!\n");
         return FAIL;
     }
+    lock_wait_add(&start);
     return SUCCESS;
 }
 
 
 /*
  * Locks inode with given inumber for writing.
+ * Threads given a lock wait function keep trying it instead, see set_lock_wait.
  * Input:
  *   - inumber: integer corresponding to an inode id
  * Return:
- *   - FAIL: if locking was unsuccessful
+ *   - FAIL: if locking was unsuccessful or the deadline of the thread passed first
  *   - SUCCESS: if locking was successful
  * */
 int lock_write(int inumber) {
+    /* work for a client that stopped waiting isn't started */
+    if (lock_deadline_passed()) return FAIL;
+
+    if (lock_wait != NULL) {
+        while (pthread_rwlock_trywrlock(&inode_table[inumber].lock) != 0) {
+            if (lock_deadline_passed()) return FAIL;
+            lock_wait();
+        }
+        return SUCCESS;
+    }
+
+    /* only locks that are busy are timed, so uncontended ones cost nothing more */
+    if (pthread_rwlock_trywrlock(&inode_table[inumber].lock) == 0) return SUCCESS;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (lock_deadline.tv_sec >= 0) {
+        struct timespec abstime;
+        lock_deadline_realtime(&abstime);
+        int res = pthread_rwlock_timedwrlock(&inode_table[inumber].lock, &abstime);
+        lock_wait_add(&start);
+        return res == 0 ? SUCCESS : FAIL;
+    }
+
     if(pthread_rwlock_wrlock(&inode_table[inumber].lock) != 0) {
         fprintf(stderr, "Error: failed to lock (write) inode!\n");
         return FAIL;
     }
+    lock_wait_add(&start);
     return SUCCESS;
 }
 
@@ -319,3 +902,26 @@ int unlock(int inumber) {
     }
     return SUCCESS;
 }
+
+
+/*
+ * Makes the calling thread try i-node locks instead of blocking on them, calling wait each time
+ * one is busy. Operations take all their locks before staging anything, so whatever wait runs
+ * never sees a half staged operation of this thread.
+ * Input:
+ *   - wait: called while a lock is busy, or NULL to block again
+ * */
+void set_lock_wait(lock_wait_fn wait) {
+    lock_wait = wait;
+}
+
+
+/*
+ * Sets the time after which the locks taken by this thread are given up on, failing with FAIL.
+ * Input:
+ *   - deadline: CLOCK_MONOTONIC time, or NULL for none
+ * */
+void set_lock_deadline(const struct timespec *deadline) {
+    if (deadline == NULL) lock_deadline.tv_sec = -1;
+    else lock_deadline = *deadline;
+}
@@ -6,6 +6,8 @@
 #include "../tecnicofs-api-constants.h"
 #include <pthread.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 
 /* FS root inode number */
@@ -18,10 +20,25 @@
 #define SUCCESS 0
 #define FAIL (-1)
 
+/* returned instead of an i-number when the deadline of the calling thread passed first */
+#define EXPIRED (-2)
+
 #define DELAY 5000
 
 #define MAX_PATH_INODE_LENGTH 100
 
+/* number of changes remembered by the change log */
+#define CHANGE_LOG_SIZE 4096
+
+/* initial size of the buffers used to build tree dumps */
+#define BUFFER_INITIAL_SIZE 4096
+
+/* commit stamp of a version that has been staged but not yet committed */
+#define PENDING_STAMP LONG_MAX
+
+/* value of a reader slot that is not inside a snapshot */
+#define NO_SNAPSHOT (-1)
+
 
 /*
  * Contains the name of the entry and respective i-number
@@ -39,6 +56,37 @@ union Data {
 	DirEntry *dirEntries; /* for directories */
 };
 
+/*
+ * Growable byte buffer. Contents are not '\0' terminated
+ */
+typedef struct out_buffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+} out_buffer;
+
+/*
+ * Committed (or staged) state of an i-node. Versions are immutable once committed and are
+ * chained from newest to oldest so that readers can find the one visible in their snapshot
+ */
+typedef struct inode_version {
+	long stamp;
+	type nodeType;
+	DirEntry *dirEntries;
+	struct inode_version *prev;
+} inode_version;
+
+/*
+ * Successful operation recorded in the change log
+ */
+typedef struct change_record {
+	long stamp;
+	char op;  /* 'c', 'd' or 'm', as in the input commands */
+	type nodeType;  /* only for creates */
+	char *path;
+	char *path_to;  /* only for moves */
+} change_record;
+
 /*
  * I-node definition
  */
@@ -46,9 +94,14 @@ typedef struct inode_t {
 	type nodeType;
 	union Data data;
     pthread_rwlock_t lock;
+    inode_version *version;
 } inode_t;
 
 
+/* called while an i-node lock is busy, by threads that must not block on it */
+typedef void (*lock_wait_fn)(void);
+
+
 void insert_delay(int cycles);
 void inode_table_init();
 void inode_table_destroy();
@@ -58,12 +111,24 @@ int inode_get(int inumber, type *nType, union Data *data);
 int inode_set_file(int inumber, char *fileContents, int len);
 int dir_reset_entry(int inumber, int sub_inumber);
 int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
-void inode_print_tree(FILE *fp, int inumber, char *name);
+void buffer_append(out_buffer *buffer, const char *bytes, size_t size);
+void buffer_free(out_buffer *buffer);
+void inode_print_tree(out_buffer *out, int inumber, out_buffer *path, long snapshot);
+long snapshot_begin();
+void snapshot_end();
+int inode_snapshot_get(int inumber, long snapshot, type *nType, union Data *data);
+long inode_commit();
+long commit_clock_now();
+void inode_log_change(char op, type nodeType, char *path, char *path_to);
+int change_log_dump(out_buffer *out, long since, long until);
 int lock_read(int inumber);
 int trylock_read(int inumber);
 int lock_write(int inumber);
 int trylock_write(int inumber);
 int unlock(int inumber);
+void set_lock_wait(lock_wait_fn wait);
+long lock_wait_time();
+void set_lock_deadline(const struct timespec *deadline);
 
 
 #endif /* INODES_H */
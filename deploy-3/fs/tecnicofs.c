@@ -0,0 +1,223 @@
+#include <string.h>
+#include "operations.h"
+#include "arena.h"
+#include "../tecnicofs.h"
+
+
+/* makes sure the file system is only set up once */
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Checks a path given by a user of the library. The engine copies paths into buffers with
+ * MAX_PATH_SIZE bytes.
+ * Input:
+ *  - path: path to check
+ * Returns: SUCCESS or FAIL
+ */
+static int check_path(char *path) {
+    return path != NULL && strlen(path) < MAX_PATH_SIZE ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Chooses the pages the i-node table, the versions and the directories are mapped with. Huge
+ * pages cut the TLB misses of walking long paths over many i-nodes. Must be called before
+ * tecnicofs_init; pages that aren't available fall back to the next kind, down to normal ones.
+ * Input:
+ *  - pages: TECNICOFS_PAGES_* kind
+ * Returns: SUCCESS or FAIL if the kind is unknown
+ */
+int tecnicofs_set_pages(int pages) {
+    return arena_set_pages(pages);
+}
+
+
+/*
+ * Returns: TECNICOFS_PAGES_* kind the file system is mapped with, after any fallback
+ */
+int tecnicofs_pages() {
+    return arena_pages();
+}
+
+
+/*
+ * Sets up the file system of the process. Calls after the first one do nothing, so every user
+ * of the library can make sure it is ready.
+ * Returns: SUCCESS
+ */
+int tecnicofs_init() {
+    pthread_once(&init_once, init_fs);
+    return SUCCESS;
+}
+
+
+/*
+ * Releases the file system of the process. It can't be set up again, so this is only called
+ * when the process is done with it.
+ */
+void tecnicofs_destroy() {
+    destroy_fs();
+}
+
+
+/*
+ * Creates a file or a directory.
+ * Input:
+ *  - path: path of the new node
+ *  - node_type: T_FILE or T_DIRECTORY
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
+ */
+int tecnicofs_create(char *path, type node_type) {
+    if (check_path(path) == FAIL || (node_type != T_FILE && node_type != T_DIRECTORY)) return TECNICOFS_ERROR_OTHER;
+    return create(path, node_type);
+}
+
+
+/*
+ * Deletes a file or an empty directory.
+ * Input:
+ *  - path: path of the node
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
+ */
+int tecnicofs_delete(char *path) {
+    if (check_path(path) == FAIL) return TECNICOFS_ERROR_OTHER;
+    return delete(path);
+}
+
+
+/*
+ * Looks a path up, in a snapshot of the file system.
+ * Input:
+ *  - path: path of the node
+ * Returns: inumber of the node or TECNICOFS_ERROR_* code
+ */
+int tecnicofs_lookup(char *path) {
+    if (check_path(path) == FAIL) return TECNICOFS_ERROR_OTHER;
+    return lookup(path);
+}
+
+
+/*
+ * Moves a file or a directory.
+ * Input:
+ *  - from: current path of the node
+ *  - to: new path of the node
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
+ */
+int tecnicofs_move(char *from, char *to) {
+    if (check_path(from) == FAIL || check_path(to) == FAIL) return TECNICOFS_ERROR_OTHER;
+    return move(from, to);
+}
+
+
+/*
+ * Prints the tree to a file.
+ * Input:
+ *  - out_file: output file path
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int tecnicofs_print(char *out_file) {
+    if (check_path(out_file) == FAIL) return TECNICOFS_ERROR_OTHER;
+    return print_tecnicofs_tree(out_file);
+}
+
+
+/*
+ * Prints the changes since an earlier print of changes to a file (see print_tecnicofs_changes).
+ * Input:
+ *  - out_file: output file path
+ *  - since: sequence number of an earlier print, or a negative one for a full print
+ *  - seq: gets the sequence number of this print
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int tecnicofs_print_changes(char *out_file, int64_t since, int64_t *seq) {
+    if (check_path(out_file) == FAIL) return TECNICOFS_ERROR_OTHER;
+    return print_tecnicofs_changes(out_file, since, seq);
+}
+
+
+/*
+ * Destination of a dump made through the library
+ */
+typedef struct dump_target {
+    tecnicofs_dump_fn fn;
+    void *arg;
+} dump_target;
+
+
+/*
+ * Print sink that hands each dumped unit to the user's function.
+ * Input:
+ *  - ptr: dump target
+ *  - units: dumped units
+ *  - amount: number of units
+ * Returns: SUCCESS or FAIL if the function asked to stop
+ */
+static int dump_sink(void *ptr, print_unit *units, int amount) {
+    dump_target *target = ptr;
+
+    for (int i = 0; i < amount; i++)
+        if (units[i].out.size > 0 && target->fn(target->arg, units[i].out.data, units[i].out.size) != 0) return FAIL;
+    return SUCCESS;
+}
+
+
+/*
+ * Dumps the tree, one path per line, to a function that gets it in pieces as soon as they are
+ * ready. Reads from a snapshot, so it doesn't stop other operations.
+ * Input:
+ *  - fn: function that consumes the dump
+ *  - arg: argument passed to fn
+ * Returns: SUCCESS or FAIL if fn stopped the dump
+ */
+int tecnicofs_dump(tecnicofs_dump_fn fn, void *arg) {
+    dump_target target = { fn, arg };
+
+    long snapshot = snapshot_begin();
+    int res = dump_tecnicofs_tree(snapshot, dump_sink, &target);
+    snapshot_end();
+
+    return res;
+}
+
+
+/*
+ * Makes the calling thread wait for busy locks by calling a function instead of blocking, so a
+ * thread running many tasks can switch to another one meanwhile. The other tasks can run
+ * operations of their own, since operations only wait for locks before changing anything.
+ * Input:
+ *  - wait: called each time a needed lock is busy, or NULL to block on locks again
+ */
+void tecnicofs_set_lock_wait(tecnicofs_wait_fn wait) {
+    set_lock_wait(wait);
+}
+
+
+/*
+ * Returns: nanoseconds threads spent blocked on locks since the start, summed over every
+ * thread. Sampled twice, it tells how much of an interval went to contention
+ */
+long tecnicofs_lock_wait_time() {
+    return lock_wait_time();
+}
+
+
+/*
+ * Returns: number of lookups that were answered with the result of an identical one running
+ *          at the same time, instead of walking the path again
+ */
+long tecnicofs_coalesced_lookups() {
+    return coalesced_lookups();
+}
+
+
+/*
+ * Sets a deadline for the operations of the calling thread. Past it, an operation that still
+ * has to take a lock gives up with TECNICOFS_ERROR_TIMEOUT instead, having changed nothing.
+ * Input:
+ *  - deadline: CLOCK_MONOTONIC time, or NULL for none
+ */
+void tecnicofs_set_deadline(const struct timespec *deadline) {
+    set_lock_deadline(deadline);
+}
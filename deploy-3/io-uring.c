@@ -0,0 +1,246 @@
+#include "io-uring.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+/*
+ * Sets up a ring and maps its queues.
+ *
+ * Input:
+ *   - ring: ring to set up
+ *   - entries: size of the submission queue (the completion queue gets twice as many)
+ * Returns: SUCCESS or FAIL (kernels without io_uring, or where it is disabled, fail here)
+ * */
+int uring_init(uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return FAIL;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* newer kernels share one mapping between both queues */
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = 0;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        return FAIL;
+    }
+
+    ring->cq_ptr = ring->sq_ptr;
+    if (ring->cq_size > 0) {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(ring->fd);
+            return FAIL;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_size > 0) munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->fd);
+        return FAIL;
+    }
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /* the array always maps slot i to entry i, so entries are prepared in place */
+    for (unsigned i = 0; i < params.sq_entries; i++) ring->sq_array[i] = i;
+    ring->sqe_tail = *ring->sq_tail;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Unmaps the queues of a ring and closes it.
+ *
+ * Input:
+ *   - ring: ring set up by uring_init
+ * */
+void uring_destroy(uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_size > 0) munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+
+/*
+ * Gets a free submission entry, cleared. It is sent to the kernel on the next uring_submit.
+ *
+ * Input:
+ *   - ring: ring
+ * Returns: entry or NULL if the submission queue is full
+ * */
+struct io_uring_sqe *uring_get_sqe(uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head > *ring->sq_mask) return NULL;
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+
+/*
+ * Sends the prepared entries to the kernel and waits for completions, in a single system call.
+ *
+ * Input:
+ *   - ring: ring
+ *   - wait: number of completions to wait for (0 to return right away)
+ * Returns: number of entries submitted or -errno
+ * */
+int uring_submit(uring *ring, unsigned wait) {
+    unsigned submitted = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    /* there is nothing to tell the kernel */
+    if (submitted == 0 && wait == 0) return 0;
+
+    int res = syscall(__NR_io_uring_enter, ring->fd, submitted, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    return res < 0 ? -errno : res;
+}
+
+
+/*
+ * Gets the oldest completion, without waiting for one.
+ *
+ * Input:
+ *   - ring: ring
+ * Returns: completion (valid until uring_cqe_seen) or NULL if there is none
+ * */
+struct io_uring_cqe *uring_peek_cqe(uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+/*
+ * Releases the completion returned by uring_peek_cqe, so the kernel can reuse its entry.
+ *
+ * Input:
+ *   - ring: ring
+ * */
+void uring_cqe_seen(uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Allocates a group of buffers and registers it with the kernel, all of them free.
+ *
+ * Input:
+ *   - ring: ring whose requests use the buffers
+ *   - buffers: group to register
+ *   - group: id of the group, given to the requests that pick from it
+ *   - entries: number of buffers (power of 2)
+ *   - size: bytes of each buffer
+ * Returns: SUCCESS or FAIL (kernels older than 5.19 fail here)
+ * */
+int uring_buffers_register(uring *ring, uring_buffers *buffers, unsigned short group, unsigned entries, unsigned size) {
+    buffers->entries = entries;
+    buffers->size = size;
+    buffers->group = group;
+    buffers->ring_size = entries * sizeof(struct io_uring_buf);
+
+    /* the kernel wants the ring page aligned */
+    buffers->ring = mmap(NULL, buffers->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED) return FAIL;
+
+    buffers->data = mmap(NULL, (size_t) entries * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->data == MAP_FAILED) {
+        munmap(buffers->ring, buffers->ring_size);
+        return FAIL;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) buffers->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(buffers->data, (size_t) entries * size);
+        munmap(buffers->ring, buffers->ring_size);
+        return FAIL;
+    }
+
+    buffers->ring->tail = 0;
+    for (unsigned short id = 0; id < entries; id++) uring_buffer_return(buffers, id);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Unregisters a group of buffers and frees it.
+ *
+ * Input:
+ *   - ring: ring the group was registered with
+ *   - buffers: group
+ * */
+void uring_buffers_unregister(uring *ring, uring_buffers *buffers) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(buffers->data, (size_t) buffers->entries * buffers->size);
+    munmap(buffers->ring, buffers->ring_size);
+}
+
+
+/*
+ * Input:
+ *   - buffers: group
+ *   - id: id of a buffer, as given in a completion
+ * Returns: start of the buffer
+ * */
+char *uring_buffer(uring_buffers *buffers, unsigned short id) {
+    return buffers->data + (size_t) id * buffers->size;
+}
+
+
+/*
+ * Gives a buffer back to the kernel, so it can be picked again.
+ *
+ * Input:
+ *   - buffers: group
+ *   - id: id of the buffer
+ * */
+void uring_buffer_return(uring_buffers *buffers, unsigned short id) {
+    unsigned short tail = buffers->ring->tail;
+    struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+
+    buf->addr = (unsigned long) uring_buffer(buffers, id);
+    buf->len = buffers->size;
+    buf->bid = id;
+
+    __atomic_store_n(&buffers->ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,52 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include "fs/state.h"  /* SUCCESS and FAIL */
+
+/*
+ * Minimal io_uring ring, set up with the raw system calls so no library is needed
+ */
+typedef struct uring {
+    int fd;
+
+    /* submission queue, shared with the kernel */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;  /* entries prepared, published to the kernel on the next submit */
+
+    /* completion queue, shared with the kernel */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* mappings, released by uring_destroy */
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+} uring;
+
+/*
+ * Group of buffers registered with the kernel. Multishot receives pick a free one for each
+ * message and the owner gives it back once done with it
+ */
+typedef struct uring_buffers {
+    struct io_uring_buf_ring *ring;
+    char *data;
+    unsigned entries;  /* power of 2 */
+    unsigned size;  /* bytes of each buffer */
+    unsigned short group;
+    size_t ring_size;
+} uring_buffers;
+
+int uring_init(uring *ring, unsigned entries);
+void uring_destroy(uring *ring);
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+int uring_submit(uring *ring, unsigned wait);
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+void uring_cqe_seen(uring *ring);
+int uring_buffers_register(uring *ring, uring_buffers *buffers, unsigned short group, unsigned entries, unsigned size);
+void uring_buffers_unregister(uring *ring, uring_buffers *buffers);
+char *uring_buffer(uring_buffers *buffers, unsigned short id);
+void uring_buffer_return(uring_buffers *buffers, unsigned short id);
+
+#endif /* IO_URING_H */
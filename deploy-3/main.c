@@ -1,178 +1,2263 @@
+#define _GNU_SOURCE  /* recvmmsg and sendmmsg */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include "fs/operations.h"
+#include "tecnicofs.h"
+#include "fs/namespace.h"
+#include "tecnicofs-protocol.h"
+#include "io-uring.h"
+#include "mpmc-queue.h"
+#include "coroutine.h"
+#include "tecnicofs-shm.h"
+#include "tecnicofs-namespace.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <strings.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
 
-#define MAX_INPUT_SIZE 100
+/* transports the server can listen on */
+#define TRANSPORT_DGRAM 0
+#define TRANSPORT_SEQPACKET 1
 
-/* server's number of threads */
+/* suffix of the name a connection socket is bound under until it listens */
+#define BIND_SUFFIX ".bind"
+
+/* engines that serve the datagram socket */
+#define ENGINE_CLASSIC 0
+#define ENGINE_URING 1
+#define ENGINE_STAGED 2
+#define ENGINE_COROUTINE 3
+
+/* number of requests read from connections and waiting for a worker */
+#define WORK_QUEUE_SIZE 1024
+
+/* maximum number of connection events handled per epoll_wait */
+#define EPOLL_EVENTS 64
+
+/* maximum number of datagrams received by one recvmmsg, and of replies sent by one sendmmsg */
+#define DGRAM_BATCH 16
+
+/* room for the control messages of a request that passes a descriptor, with the credentials of
+ * its sender */
+#define FD_CONTROL_SIZE (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct ucred)))
+
+/* staged engine: room in the queues between its stages */
+#define STAGE_QUEUE_SIZE 4096
+
+/* staged engine: classes of requests, each queued apart. reads are short and wanted soon,
+ * writes hold locks and bulk requests (prints and streams) take long */
+#define CLASS_READ 0
+#define CLASS_WRITE 1
+#define CLASS_BULK 2
+#define CLASSES 3
+
+/* staged engine: requests of each class allowed to wait by default, past which they are turned
+ * away busy */
+#define READ_QUEUE_SIZE 4096
+#define WRITE_QUEUE_SIZE 1024
+#define BULK_QUEUE_SIZE 64
+
+/* staged engine: order in which workers serve the classes, giving reads 4 turns, writes 2 and
+ * bulk requests 1. a class with nothing queued gives its turn to the others */
+#define CLASS_TURNS 7
+#define CLASS_SCHEDULE { CLASS_READ, CLASS_WRITE, CLASS_READ, CLASS_BULK, CLASS_READ, CLASS_WRITE, CLASS_READ }
+
+/* dynamic pool: time between resizes, ticks with an empty queue before dropping a thread, and
+ * shares of lock waiting and CPU use past which the pool doesn't grow */
+#define POOL_INTERVAL_MS 100
+#define POOL_IDLE_TICKS 10
+#define POOL_MAX_LOCK_WAIT 0.5
+#define POOL_MAX_CPU 0.9
+
+/* streamed prints: longest a message waits for room at the client before the stream is aborted,
+ * and longest each wait for the socket to be writable lasts */
+#define STREAM_SEND_TIMEOUT_MS 1000
+#define STREAM_POLL_MS 10
+
+/* coroutine engine: requests each worker runs at once by default, and stack of each one */
+#define WORKER_COROUTINES 64
+#define COROUTINE_STACK_SIZE (256 * 1024)
+
+/* coroutine engine: passes over tasks that all wait for locks before the worker stops yielding
+ * the CPU and sleeps, and the longest each sleep lasts, in milliseconds */
+#define COROUTINE_IDLE_PASSES 16
+#define COROUTINE_IDLE_MS 1
+
+/* io_uring engine: size of the ring's submission queue, receive buffers and replies in flight */
+#define URING_ENTRIES 256
+#define URING_BUFFERS 32
+#define URING_REPLIES 128
+
+/* requests received by the ring that can wait for a worker, when there is more than one */
+#define URING_QUEUE_SIZE 1024
+
+/* room for the client address in each receive buffer. a multiple of 8 keeps the message after
+ * it aligned for the header */
+#define URING_NAME_SIZE 112
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + URING_NAME_SIZE + FD_CONTROL_SIZE + TFS_MAX_MESSAGE)
+
+/* user_data of the multishot receive; replies use the index of their slot */
+#define URING_RECEIVE ((__u64) -1)
+
+/* server's number of threads. changed by the pool controller when the pool has bounds */
 int numberThreads = 0;
 
-/* server socket file descriptor */
-int server_socket_fd;
+/* bounds of the worker pool (pool_max is 0 if the pool keeps its size) */
+int pool_min = 0;
+int pool_max = 0;
+
+/* requests handled since the start, sampled by the pool controller */
+long handled_requests = 0;
+
+/* server socket file descriptor */
+int server_socket_fd;
+
+/* transport the server listens on */
+int transport = TRANSPORT_DGRAM;
+
+/* engine that serves the datagram socket */
+int engine = ENGINE_CLASSIC;
+
+/* threads of the receive and reply stages of the staged engine */
+int receive_threads = 1;
+int reply_threads = 1;
+
+/* requests of each class the staged engine lets wait for a worker */
+int class_limits[CLASSES] = { READ_QUEUE_SIZE, WRITE_QUEUE_SIZE, BULK_QUEUE_SIZE };
+
+/* 1 if the io_uring engine receives on a thread of its own and hands requests to the workers */
+int uring_dispatch = 0;
+
+/* requests each worker of the coroutine engine runs at once */
+int worker_coroutines = WORKER_COROUTINES;
+
+/* 1 if clients may move their sessions to shared memory */
+int shm_sessions = 0;
+
+/* 1 if the namespace is mirrored for clients to look paths up on their own */
+int namespace_mirror = 0;
+
+/* 1 if every request executed is written to stdout */
+int log_requests = 0;
+
+/* CPUs the workers are pinned to, in turn (none if pinned_count is 0) */
+int pinned_cpus[CPU_SETSIZE];
+int pinned_count = 0;
+
+/* workers pinned so far, which picks the CPU of the next one */
+int next_pinned = 0;
+
+
+/*
+ * Sets socket address and inits everything.
+ *
+ * Input:
+ *   - path: socket path
+ *   - addr: socket address
+ * Output:
+ *   - size of socket
+ * */
+int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
+
+    if (addr == NULL) return 0;  /* interrupts if address is invalid */
+
+    bzero((char *)addr, sizeof(struct sockaddr_un));  /* clears possible values in addr variable */
+    addr->sun_family = AF_UNIX;  /* sets socket domain as unix */
+    strcpy(addr->sun_path, path);  /* copies path to the socket */
+
+    return SUN_LEN(addr);
+}
+
+
+/*
+ * Request decoded from a message. The header and the paths point into the message itself
+ */
+typedef struct tfs_request {
+    tfs_request_header *header;
+    char *path[2];  /* NULL if absent */
+    char *payload;  /* bytes after the paths (operations of a batch) */
+    int payload_size;
+    int64_t seq;  /* sequence number of a print of changes, sent back after the status */
+} tfs_request;
+
+
+/*
+ * Client that sent a request and gets its response. Datagram clients are answered at their
+ * address; connected clients have none (addrlen is 0) and are answered on their connection
+ */
+typedef struct tfs_client {
+    int fd;  /* socket the response is sent on */
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    int passed_fd;  /* descriptor passed with the request (-1 if none), closed once it is handled */
+    pid_t pid;  /* process that sent a datagram, as told by the kernel (0 if unknown) */
+    tfs_shm_region *shm;  /* region the client is answered in (NULL for socket clients) */
+} tfs_client;
+
+
+/*
+ * Shared memory session handed to the thread that serves it
+ */
+typedef struct shm_session {
+    tfs_shm_region *region;  /* mapped by attach_shm_session */
+    pid_t client_pid;  /* process of the client, as told by the kernel */
+} shm_session;
+
+
+/*
+ * Connection of a client in seqpacket mode. It is closed once the client is gone and no
+ * worker holds a request read from it
+ */
+typedef struct connection {
+    int fd;
+    int refs;  /* one while registered in epoll, plus one per request being handled */
+} connection;
+
+
+/*
+ * Request read from a connection, waiting for a worker
+ */
+typedef struct work_item {
+    connection *conn;
+    char *message;  /* allocated with the exact size of the message */
+    int size;
+    int passed_fd;  /* descriptor passed with the request (-1 if none) */
+} work_item;
+
+
+/*
+ * Replies without payload held back by a datagram worker, to be sent together once all the
+ * messages it received at once are handled
+ */
+typedef struct reply_batch {
+    tfs_response_header headers[DGRAM_BATCH];
+    struct sockaddr_un addrs[DGRAM_BATCH];
+    struct iovec iov[DGRAM_BATCH];
+    struct mmsghdr msgs[DGRAM_BATCH];
+    int count;
+} reply_batch;
+
+/*
+ * Request read by the receive stage, waiting for a worker. The message follows it
+ */
+typedef struct staged_request {
+    tfs_client client;
+    int size;
+    char message[] __attribute__((aligned(8)));  /* aligned for the header */
+} staged_request;
+
+/*
+ * Reply made by a worker, waiting for the reply stage. The payload follows it
+ */
+typedef struct staged_reply {
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    tfs_response_header header;
+    char payload[];
+} staged_reply;
+
+/*
+ * Request run by a coroutine of a worker of the coroutine engine
+ */
+typedef struct coroutine_task {
+    coroutine co;
+    tfs_client client;
+    int size;
+    char *message;  /* TFS_MAX_MESSAGE bytes, which keeps it aligned for the header */
+} coroutine_task;
+
+/*
+ * Reply being sent by the io_uring engine. The kernel may send it after the submission returns,
+ * so it lives here until its completion arrives
+ */
+typedef struct uring_reply {
+    tfs_response_header header;
+    struct sockaddr_un addr;
+    struct iovec iov;
+    struct msghdr msg;
+    int next_free;  /* index of the next free slot (-1 if none) */
+} uring_reply;
+
+
+/* replies held back by this thread (NULL if replies are sent right away) */
+__thread reply_batch *pending_replies = NULL;
+
+/* 1 if this thread hands its replies to the reply stage */
+__thread int staged_replies = 0;
+
+/* staged engine: requests waiting for a worker and replies waiting for a sender */
+mpmc_queue execute_queues[CLASSES];
+mpmc_queue reply_queue;
+
+/* requests waiting in all the classes, which workers sleep on */
+sem_t execute_ready;
+
+/* requests turned away because their class was full */
+long rejected_requests = 0;
+
+/* next turn of this worker in CLASS_SCHEDULE */
+__thread int class_turn = 0;
+
+/* queued for a worker of the staged engine to leave the pool */
+staged_request retire_request;
+
+/* io_uring engine with more than one worker: requests taken from the ring, waiting for a worker */
+mpmc_queue uring_queue;
+
+/* queued for each worker of the io_uring engine when the kernel has no io_uring */
+staged_request uring_fallback_request;
+
+/* spinning rounds of this thread's shared memory session before it sleeps */
+__thread int shm_spin = 0;
+
+/* positions of this thread's shared memory session in its request and response rings. the
+ * copies in the region are only written here, since the client can change them at any time */
+__thread uint32_t shm_request_head = 0, shm_response_tail = 0;
+
+/* process of the client of this thread's shared memory session */
+__thread pid_t shm_client_pid = 0;
+
+/* deadline of the request this thread (or coroutine) is executing, 0 for none */
+__thread uint32_t request_deadline = 0;
+
+/* requests dropped because their deadline passed before they were done */
+long expired_requests = 0;
+
+/* responses sent by the thread that executed the request instead of the reply stage: stream
+ * messages and responses of shared memory sessions */
+long direct_replies = 0;
+
+
+/* requests read by the epoll thread, handed out to the workers in order of arrival */
+work_item work_queue[WORK_QUEUE_SIZE];
+int work_head = 0, work_count = 0;
+pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t work_not_empty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t work_not_full = PTHREAD_COND_INITIALIZER;
+
+
+/*
+ * Destination of a streamed print
+ */
+typedef struct stream_target {
+    tfs_client *client;
+    tfs_request_header *request;
+    union {
+        tfs_response_header header;
+        char bytes[sizeof(tfs_response_header) + STREAM_CHUNK_SIZE];
+    } message;
+    int size;  /* dump bytes waiting in message */
+    int aborted;  /* set once a message couldn't be sent */
+} stream_target;
+
+
+/*
+ * Reads a list of CPUs such as "0-3,8,10-11".
+ *
+ * Input:
+ *   - list: list given on the command line
+ *   - cpus: gets the CPUs, in the order given
+ * Output:
+ *   - number of CPUs or FAIL if the list is invalid
+ * */
+int parse_cpu_list(char *list, int *cpus) {
+    int count = 0;
+
+    while (*list != '\0') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (end == list) return FAIL;
+
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return FAIL;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE || count + (last - first + 1) > CPU_SETSIZE) return FAIL;
+
+        for (long cpu = first; cpu <= last; cpu++) cpus[count++] = (int) cpu;
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return FAIL;
+        list = end;
+    }
+
+    return count > 0 ? count : FAIL;
+}
+
+
+/*
+ * Pins the calling thread to one of the CPUs given with -a, so it stops migrating and the pages
+ * it touches first, such as the runs its slab fronts carve objects from, are placed on that
+ * CPU's NUMA node. Does nothing without -a.
+ *
+ * Input:
+ *   - index: position of the thread, which picks the CPU (index modulo the number of CPUs)
+ * */
+void pin_thread(int index) {
+    if (pinned_count == 0) return;
+
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(pinned_cpus[index % pinned_count], &cpu);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) != 0)
+        fprintf(stderr, "Warning: couldn't pin a worker to CPU %d\n", pinned_cpus[index % pinned_count]);
+}
+
+
+/*
+ * Checks a request and finds its paths, without copying anything out of the message.
+ *
+ * Input:
+ *   - message: received message, aligned for a tfs_request_header
+ *   - size: number of bytes received
+ *   - request: gets the decoded request
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int decode_request(char *message, int size, tfs_request *request) {
+
+    if (size < (int) sizeof(tfs_request_header)) return FAIL;
+
+    request->header = (tfs_request_header *) message;
+    if (request->header->version != TFS_PROTOCOL_VERSION) return FAIL;
+
+    char *path = message + sizeof(tfs_request_header);
+    int left = size - (int) sizeof(tfs_request_header);
+
+    /* every path must fit in the message and end in its only '\0' */
+    for (int i = 0; i < 2; i++) {
+        int path_size = request->header->path_size[i];
+        request->path[i] = NULL;
+        if (path_size == 0) continue;
+
+        if (path_size > left || path_size > MAX_PATH_SIZE || path[path_size - 1] != '\0'
+                || (int) strlen(path) != path_size - 1) return FAIL;
+
+        request->path[i] = path;
+        path += path_size;
+        left -= path_size;
+    }
+
+    request->payload = path;
+    request->payload_size = left;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Takes the descriptor passed with a received message. Any others are closed, since no request
+ * uses more than one.
+ *
+ * Input:
+ *   - msg: header of the received message, with its control data
+ *   - pid: gets the process that sent it, when the kernel added its credentials (0 otherwise).
+ *     NULL if not wanted
+ * Output:
+ *   - descriptor or -1 if none was passed
+ * */
+int take_passed_fd(struct msghdr *msg, pid_t *pid) {
+    int fd = -1;
+
+    if (pid != NULL) *pid = 0;
+    if (msg->msg_controllen == 0) return -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS && pid != NULL
+                && cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+            struct ucred cred;
+            memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+            *pid = cred.pid;
+        }
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++) {
+            int passed;
+            memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (fd == -1) fd = passed;
+            else close(passed);
+        }
+    }
+    return fd;
+}
+
+
+/*
+ * Checks if the client of a shared memory session is still there. Its process is the one the
+ * kernel named when the session was attached, never the one the client wrote in the region.
+ *
+ * Input:
+ *   - region: region of the session
+ * Output:
+ *   - 1 if it is, 0 if it closed the session or died
+ * */
+int shm_client_alive(tfs_shm_region *region) {
+    if (__atomic_load_n(&region->closed, __ATOMIC_ACQUIRE)) return 0;
+    return kill(shm_client_pid, 0) == 0 || errno != ESRCH;
+}
+
+
+/*
+ * Writes a response to the response ring of a shared memory session, waiting while the client
+ * hasn't made room for it.
+ *
+ * Input:
+ *   - region: region of the session
+ *   - header: response header, or the whole message if payload is NULL
+ *   - header_size: bytes of header
+ *   - payload: bytes written after the header (NULL if none)
+ *   - size: number of bytes of payload
+ *   - give_up: time (in tfs_clock_ms) past which it stops waiting, or 0 to wait while the client lives
+ * Output:
+ *   - SUCCESS or FAIL if the client is gone or give_up passed
+ * */
+int shm_send(tfs_shm_region *region, void *header, int header_size, void *payload, int size, uint32_t give_up) {
+
+    tfs_shm_ring *ring = &region->responses;
+    uint32_t need = TFS_SHM_RECORD(header_size + size);
+
+    while (1) {
+        uint32_t seen = __atomic_load_n(&region->server_bell.seq, __ATOMIC_ACQUIRE);
+
+        /* same as tfs_shm_reserve, but from the tail kept by this thread. a head moved by the
+         * client can only make it overwrite responses the client hasn't read */
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t offset = shm_response_tail & (TFS_SHM_RING_SIZE - 1);
+        uint32_t skip = offset + need > TFS_SHM_RING_SIZE ? TFS_SHM_RING_SIZE - offset : 0;
+
+        if (TFS_SHM_RING_SIZE - (shm_response_tail - head) >= skip + need) {
+            if (skip > 0) {
+                *(uint32_t *) (ring->data + offset) = TFS_SHM_WRAP;
+                shm_response_tail += skip;
+                offset = 0;
+            }
+            *(uint32_t *) (ring->data + offset) = header_size + size;
+            memcpy(ring->data + offset + 8, header, header_size);
+            if (size > 0) memcpy(ring->data + offset + 8 + header_size, payload, size);
+
+            shm_response_tail += need;
+            __atomic_store_n(&ring->tail, shm_response_tail, __ATOMIC_RELEASE);
+            tfs_shm_ring_bell(&region->client_bell);
+            __atomic_add_fetch(&direct_replies, 1, __ATOMIC_RELAXED);
+            return SUCCESS;
+        }
+        if (give_up != 0 && tfs_time_left(give_up) <= 0) return FAIL;
+
+        /* the client rings the server's bell whenever it takes a response */
+        if (! tfs_shm_wait(&region->server_bell, seen, &shm_spin) && ! shm_client_alive(region)) return FAIL;
+    }
+}
+
+
+/*
+ * Sends a response to a client.
+ *
+ * Input:
+ *   - client: client that made the request
+ *   - request: header of the request being answered
+ *   - status: result of the request
+ *   - payload: bytes sent after the header (NULL if none)
+ *   - size: number of bytes of payload
+ * */
+void send_response(tfs_client *client, tfs_request_header *request, int status, void *payload, int size) {
+    tfs_response_header response = { TFS_PROTOCOL_VERSION, request->opcode, 0, request->request_id, status, size };
+
+    if (client->shm != NULL) {
+        shm_send(client->shm, &response, sizeof(response), payload, size, 0);
+        return;
+    }
+
+    /* workers of the staged engine leave the sending to the reply stage */
+    if (staged_replies && client->addrlen > 0) {
+        staged_reply *reply = malloc(sizeof(staged_reply) + size);
+        if (reply != NULL) {
+            memcpy(&reply->addr, &client->addr, client->addrlen);
+            reply->addrlen = client->addrlen;
+            reply->header = response;
+            if (size > 0) memcpy(reply->payload, payload, size);
+            mpmc_push(&reply_queue, reply);
+            return;
+        }
+    }
+
+    /* payloads don't outlive the call, so only bare replies are held back */
+    reply_batch *replies = pending_replies;
+    if (replies != NULL && size == 0 && client->addrlen > 0 && replies->count < DGRAM_BATCH) {
+        int i = replies->count++;
+        replies->headers[i] = response;
+        memcpy(&replies->addrs[i], &client->addr, client->addrlen);
+        replies->iov[i].iov_base = &replies->headers[i];
+        replies->iov[i].iov_len = sizeof(tfs_response_header);
+
+        struct msghdr *msg = &replies->msgs[i].msg_hdr;
+        bzero(msg, sizeof(struct msghdr));
+        msg->msg_name = &replies->addrs[i];
+        msg->msg_namelen = client->addrlen;
+        msg->msg_iov = &replies->iov[i];
+        msg->msg_iovlen = 1;
+        return;
+    }
+
+    /* header and payload are gathered by the kernel, so neither is copied here */
+    struct iovec iov[2] = { { &response, sizeof(response) }, { payload, size } };
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = client->addrlen > 0 ? &client->addr : NULL;
+    msg.msg_namelen = client->addrlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size > 0 ? 2 : 1;
+
+    /* a client that closed its connection must not kill the server with SIGPIPE */
+    sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+}
+
+
+/*
+ * Sends the replies held back by a worker, as few sendmmsg calls as possible.
+ *
+ * Input:
+ *   - replies: replies held back
+ * */
+void flush_replies(reply_batch *replies) {
+    int sent = 0;
+
+    while (sent < replies->count) {
+        int c = sendmmsg(server_socket_fd, replies->msgs + sent, replies->count - sent, MSG_NOSIGNAL);
+        if (c > 0) sent += c;
+        else if (errno != EINTR) sent++;  /* the client of the first reply is gone, skips it */
+    }
+
+    replies->count = 0;
+}
+
+
+/*
+ * Sends the message held by a stream to the client.
+ *
+ * Input:
+ *   - target: stream
+ *   - more: 0 if this is the last message
+ *   - status: status reported in the message
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int stream_flush(stream_target *target, int more, int status) {
+    tfs_response_header *header = &target->message.header;
+    header->version = TFS_PROTOCOL_VERSION;
+    header->opcode = target->request->opcode;
+    header->flags = more ? TFS_FLAG_MORE : 0;
+    header->request_id = target->request->request_id;
+    header->status = status;
+    header->size = target->size;
+
+    int size = sizeof(tfs_response_header) + target->size;
+    target->size = 0;
+
+    /* a slow reader throttles the dump instead of making the server drop messages, but only for
+     * so long: the dump holds a snapshot, so a client that stops reading can't keep it forever.
+     * once a message was dropped the last one gets a single try */
+    uint32_t give_up = tfs_deadline(target->aborted ? 0 : STREAM_SEND_TIMEOUT_MS);
+    if (request_deadline != 0 && tfs_time_left(request_deadline) < tfs_time_left(give_up)) give_up = request_deadline;
+
+    tfs_client *client = target->client;
+    if (client->shm != NULL) return shm_send(client->shm, target->message.bytes, size, NULL, 0, give_up);
+
+    while (sendto(client->fd, target->message.bytes, size, MSG_DONTWAIT | MSG_NOSIGNAL,
+                  client->addrlen > 0 ? (struct sockaddr *) &client->addr : NULL, client->addrlen) < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return FAIL;
+
+        int32_t left = tfs_time_left(give_up);
+        if (left <= 0) return FAIL;
+
+        /* the socket of a datagram server shows as writable even while the client's queue is
+         * full, so a wait that ends at once is followed by a short sleep */
+        struct pollfd writable = { client->fd, POLLOUT, 0 };
+        if (poll(&writable, 1, left < STREAM_POLL_MS ? left : STREAM_POLL_MS) > 0) usleep(1000);
+    }
+    __atomic_add_fetch(&direct_replies, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/*
+ * Dump function that sends the dump to a client in messages of up to STREAM_CHUNK_SIZE bytes.
+ *
+ * Input:
+ *   - ptr: stream target
+ *   - bytes: piece of the dump
+ *   - amount: number of bytes
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int stream_sink(void *ptr, const char *bytes, size_t amount) {
+    stream_target *target = ptr;
+    size_t sent = 0;
+
+    while (sent < amount) {
+        size_t size = amount - sent;
+        if (size > (size_t) (STREAM_CHUNK_SIZE - target->size)) size = STREAM_CHUNK_SIZE - target->size;
+
+        memcpy(target->message.bytes + sizeof(tfs_response_header) + target->size, bytes + sent, size);
+        target->size += size;
+        sent += size;
+
+        if (target->size == STREAM_CHUNK_SIZE && stream_flush(target, 1, SUCCESS) == FAIL) {
+            target->aborted = 1;
+            return FAIL;
+        }
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Streams the file system tree back to a client instead of writing it to a file. A client that
+ * doesn't take a message within STREAM_SEND_TIMEOUT_MS, or by the deadline of the request,
+ * gets the stream ended with TECNICOFS_ERROR_CONNECTION_ERROR.
+ *
+ * Input:
+ *   - client: client that made the request
+ *   - request: header of the request
+ * */
+void stream_tecnicofs_tree(tfs_client *client, tfs_request_header *request) {
+    stream_target target;
+    target.client = client;
+    target.request = request;
+    target.size = 0;
+    target.aborted = 0;
+
+    /* a dump takes a while, so replies held back so far don't wait for it */
+    if (pending_replies != NULL) flush_replies(pending_replies);
+
+    int res = tecnicofs_dump(stream_sink, &target);
+
+    stream_flush(&target, 0, res == SUCCESS ? SUCCESS : TECNICOFS_ERROR_CONNECTION_ERROR);
+}
+
+
+int execute_request(tfs_request *request, tfs_client *client);
+void *shm_session_thread(void *ptr);
+
+
+/*
+ * Input:
+ *   - opcode: OP_* code of a request
+ * Output:
+ *   - 1 if the request sends its own response instead of being answered with its status
+ * */
+int answers_itself(int opcode) {
+    return opcode == OP_STREAM || opcode == OP_BATCH || opcode == OP_STATS;
+}
+
+
+/*
+ * Input:
+ *   - message: request received by the staged engine
+ *   - size: number of bytes received
+ * Output:
+ *   - class of the request. messages too short to be requests are reads, as they are answered
+ *     right away
+ * */
+int request_class(char *message, int size) {
+    if (size < (int) sizeof(tfs_request_header)) return CLASS_READ;
+
+    switch (((tfs_request_header *) message)->opcode) {
+        case OP_CREATE:
+        case OP_DELETE:
+        case OP_MOVE:
+        case OP_BATCH:
+            return CLASS_WRITE;
+
+        case OP_PRINT:
+        case OP_PRINT_CHANGES:
+        case OP_STREAM:
+            return CLASS_BULK;
+
+        default:  /* lookups, stats and attaches */
+            return CLASS_READ;
+    }
+}
+
+
+/*
+ * Output:
+ *   - requests waiting for a worker of the staged engine, in every class
+ * */
+int staged_depth() {
+    int depth = 0;
+    for (int c = 0; c < CLASSES; c++) depth += (int) mpmc_depth(&execute_queues[c]);
+    return depth;
+}
+
+
+/*
+ * Answers with the threads of each stage of the server and how many items wait between them.
+ *
+ * Input:
+ *   - request: header of the request
+ *   - client: client that made the request
+ * */
+void report_stats(tfs_request_header *request, tfs_client *client) {
+    tfs_stats stats;
+    bzero(&stats, sizeof(stats));
+    stats.workers = __atomic_load_n(&numberThreads, __ATOMIC_RELAXED);
+
+    if (transport == TRANSPORT_SEQPACKET) {
+        stats.receivers = 1;  /* the epoll thread */
+        stats.execute_depth = __atomic_load_n(&work_count, __ATOMIC_RELAXED);
+        stats.execute_capacity = WORK_QUEUE_SIZE;
+    }
+    else if (engine == ENGINE_STAGED) {
+        stats.receivers = receive_threads;
+        stats.senders = reply_threads;
+        stats.execute_depth = staged_depth();
+        for (int c = 0; c < CLASSES; c++) stats.execute_capacity += class_limits[c];
+        stats.rejected = (int32_t) __atomic_load_n(&rejected_requests, __ATOMIC_RELAXED);
+        stats.reply_depth = mpmc_depth(&reply_queue);
+        stats.reply_capacity = STAGE_QUEUE_SIZE;
+        stats.direct = (int32_t) __atomic_load_n(&direct_replies, __ATOMIC_RELAXED);
+    }
+    else if (engine == ENGINE_URING && uring_dispatch) {
+        stats.receivers = 1;  /* the thread with the ring */
+        stats.execute_depth = mpmc_depth(&uring_queue);
+        stats.execute_capacity = URING_QUEUE_SIZE;
+    }
+
+    stats.expired = (int32_t) __atomic_load_n(&expired_requests, __ATOMIC_RELAXED);
+    stats.coalesced = (int32_t) tecnicofs_coalesced_lookups();
+
+    send_response(client, request, SUCCESS, &stats, sizeof(stats));
+}
+
+
+/*
+ * Moves a client to a shared memory session. The client passes a sealed memfd with the region,
+ * which the server maps and serves from a thread of its own for as long as the client uses it.
+ *
+ * Input:
+ *   - client: client that made the request, with the passed descriptor
+ * Output:
+ *   - SUCCESS or TECNICOFS_ERROR_OTHER if the server doesn't allow it or the region is invalid
+ * */
+int attach_shm_session(tfs_client *client) {
+
+    int fd = client->passed_fd;
+    pid_t pid = client->pid;
+    struct stat info;
+
+    if (! shm_sessions || fd == -1 || client->shm != NULL) return TECNICOFS_ERROR_OTHER;
+
+    /* the session ends when its client dies, so the server needs the client's process from the
+     * kernel: the peer of a connection, or the credentials added to a datagram */
+    if (client->addrlen == 0) {
+        struct ucred cred;
+        socklen_t size = sizeof(cred);
+        pid = getsockopt(client->fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) == 0 ? cred.pid : 0;
+    }
+    if (pid <= 0) return TECNICOFS_ERROR_OTHER;
+
+    /* a client that could shrink the region would kill the server with SIGBUS, so it must be
+     * sealed against shrinking, for good */
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || (seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) != (F_SEAL_SHRINK | F_SEAL_SEAL)
+            || fstat(fd, &info) == -1 || info.st_size < (off_t) sizeof(tfs_shm_region)) return TECNICOFS_ERROR_OTHER;
+
+    tfs_shm_region *region = mmap(NULL, sizeof(tfs_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) return TECNICOFS_ERROR_OTHER;
+
+    shm_session *session = malloc(sizeof(shm_session));
+    if (session == NULL) {
+        munmap(region, sizeof(tfs_shm_region));
+        return TECNICOFS_ERROR_OTHER;
+    }
+    session->region = region;
+    session->client_pid = pid;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    region->server_pid = getpid();
+    int res = region->version == TFS_SHM_VERSION ? pthread_create(&thread, &attr, shm_session_thread, session) : -1;
+    pthread_attr_destroy(&attr);
+
+    if (res != 0) {
+        free(session);
+        munmap(region, sizeof(tfs_shm_region));
+        return TECNICOFS_ERROR_OTHER;
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Sets the deadline of the request this thread executes, which the locks of the file system
+ * give up at.
+ *
+ * Input:
+ *   - deadline: deadline sent by the client, or 0 for none
+ * */
+void set_request_deadline(uint32_t deadline) {
+    request_deadline = deadline;
+
+    if (deadline == 0) {
+        tecnicofs_set_deadline(NULL);
+        return;
+    }
+
+    int32_t left = tfs_time_left(deadline);
+    struct timespec abstime;
+    clock_gettime(CLOCK_MONOTONIC, &abstime);
+    if (left > 0) {
+        abstime.tv_sec += left / 1000;
+        abstime.tv_nsec += (left % 1000) * 1000000L;
+        if (abstime.tv_nsec >= 1000000000L) {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000L;
+        }
+    }
+    tecnicofs_set_deadline(&abstime);
+}
+
+
+/*
+ * Output:
+ *   - 1 if the request this thread executes has a deadline that already passed, 0 otherwise
+ * */
+int request_expired() {
+    return request_deadline != 0 && tfs_time_left(request_deadline) <= 0;
+}
+
+
+/*
+ * Executes the operations of a batch in order, each one seeing the effects of the ones before
+ * it, and answers with the status of each of them. Operations are not atomic as a whole: each
+ * one is committed on its own and a failed one doesn't stop the others. A print of changes only
+ * reports its status, since its sequence number doesn't fit in one.
+ *
+ * Input:
+ *   - request: decoded batch request
+ *   - client: client that made the request
+ * */
+void execute_batch(tfs_request *request, tfs_client *client) {
+
+    int32_t results[TFS_MAX_BATCH];
+
+    if (request->header->arg < 0 || request->header->arg > TFS_MAX_BATCH) {
+        send_response(client, request->header, TECNICOFS_ERROR_OTHER, NULL, 0);
+        return;
+    }
+    int count = (int) request->header->arg;
+
+    char *next = request->payload;
+    int left = request->payload_size;
+
+    for (int i = 0; i < count; i++) {
+        tfs_request operation;
+
+        /* once an operation can't be decoded, the ones after it can't be found either */
+        if (decode_request(next, left, &operation) == FAIL) {
+            for (; i < count; i++) results[i] = TECNICOFS_ERROR_OTHER;
+            break;
+        }
+
+        int size = TFS_ALIGN((int) sizeof(tfs_request_header) + operation.header->path_size[0] + operation.header->path_size[1]);
+        next += size;
+        left -= size > left ? left : size;
+
+        /* operations that answer the client themselves can't be batched */
+        if (answers_itself(operation.header->opcode) || operation.header->opcode == OP_SHM_ATTACH)
+            results[i] = TECNICOFS_ERROR_OTHER;
+        /* the client no longer waits for what is left */
+        else if (request_expired())
+            results[i] = TECNICOFS_ERROR_TIMEOUT;
+        else
+            results[i] = execute_request(&operation, client);
+    }
+
+    send_response(client, request->header, SUCCESS, results, count * (int) sizeof(int32_t));
+}
+
+
+/*
+ * Writes a request and its result to stdout.
+ *
+ * Input:
+ *   - request: request executed
+ *   - res: result of the operation
+ * */
+void log_request(tfs_request *request, int res) {
+    char *name_1 = request->path[0];
+
+    switch (request->header->opcode) {
+        case OP_CREATE:
+            if (request->header->flags & TFS_FLAG_DIRECTORY) printf("Create directory: %s\n", name_1);
+            else printf("Create file: %s\n", name_1);
+            break;
+        case OP_LOOKUP:
+            if (res >= 0) printf("Search: %s found\n", name_1);
+            else printf("Search: %s not found\n", name_1);
+            break;
+        case OP_DELETE:
+            printf("Delete: %s\n", name_1);
+            break;
+        case OP_MOVE:
+            printf("Move: %s\n", name_1);
+            break;
+        case OP_PRINT:
+            printf("Print: %s\n", name_1);
+            break;
+        case OP_STREAM:
+            printf("Stream\n");
+            break;
+        case OP_PRINT_CHANGES:
+            printf("Print changes: %s\n", name_1);
+            break;
+    }
+}
+
+
+/*
+ * Executes a request. Streams, batches and stats answer the client themselves; every other
+ * request is answered by the caller with the returned status.
+ *
+ * Input:
+ *   - request: decoded request
+ *   - client: client that made the request
+ * Output:
+ *   - result of the operation or TECNICOFS_ERROR_* code
+ * */
+int execute_request(tfs_request *request, tfs_client *client) {
+
+    char *name_1 = request->path[0], *name_2 = request->path[1];
+    int res;
+
+    /* every operation other than streams, batches, stats and attaches works on at least one
+     * path, and moves on two */
+    if ((! answers_itself(request->header->opcode) && request->header->opcode != OP_SHM_ATTACH && name_1 == NULL)
+            || (request->header->opcode == OP_MOVE && name_2 == NULL)) {
+        fprintf(stderr, "Error: request is missing a path\n");
+        return TECNICOFS_ERROR_OTHER;
+    }
+
+    /* prints and lookups read from a snapshot of the file system, so no command needs to wait
+     * for the others to finish before being executed */
+    switch (request->header->opcode) {
+        case OP_CREATE:
+            res = tecnicofs_create(name_1, request->header->flags & TFS_FLAG_DIRECTORY ? T_DIRECTORY : T_FILE);
+            break;
+
+        case OP_LOOKUP:
+            res = tecnicofs_lookup(name_1);
+            break;
+
+        case OP_DELETE:
+            res = tecnicofs_delete(name_1);
+            break;
+
+        case OP_MOVE:
+            res = tecnicofs_move(name_1, name_2);
+            break;
+
+        case OP_PRINT:
+            res = tecnicofs_print(name_1);
+            break;
+
+        case OP_STREAM:
+            stream_tecnicofs_tree(client, request->header);
+            res = SUCCESS;
+            break;
+
+        case OP_PRINT_CHANGES: {
+            int64_t seq = 0;
+            res = tecnicofs_print_changes(name_1, request->header->arg, &seq);
+            request->seq = seq;
+            break;
+        }
+
+        case OP_BATCH:
+            execute_batch(request, client);
+            return SUCCESS;
+
+        case OP_SHM_ATTACH:
+            return attach_shm_session(client);
+
+        case OP_STATS:
+            report_stats(request->header, client);
+            return SUCCESS;
+
+        default: { /* error */
+            fprintf(stderr, "Error: invalid opcode %d\n", request->header->opcode);
+            return TECNICOFS_ERROR_OTHER;
+        }
+    }
+
+    /* off by default: stdout is shared by every worker, so writing to it serializes them */
+    if (log_requests) log_request(request, res);
+    return res;
+}
+
+
+/*
+ * Decodes and executes a request, then answers the client. Requests whose deadline passed
+ * while they waited are answered with TECNICOFS_ERROR_TIMEOUT without being executed, and the
+ * ones executed give up on locks they can't take before it.
+ *
+ * Input:
+ *   - message: received message, aligned for a tfs_request_header
+ *   - size: number of bytes received
+ *   - client: client that sent the message
+ * */
+void handle_message(char *message, int size, tfs_client *client) {
+
+    tfs_request request;  /* request decoded from the message */
+
+    if (decode_request(message, size, &request) == FAIL) {
+        fprintf(stderr, "Error: invalid request\n");
+        /* answers only when we know which request it was */
+        if (size >= (int) sizeof(tfs_request_header))
+            send_response(client, (tfs_request_header *) message, TECNICOFS_ERROR_OTHER, NULL, 0);
+    }
+    else if (request.header->deadline != 0 && tfs_time_left(request.header->deadline) <= 0) {
+        __atomic_add_fetch(&expired_requests, 1, __ATOMIC_RELAXED);
+        send_response(client, request.header, TECNICOFS_ERROR_TIMEOUT, NULL, 0);
+    }
+    else {
+        set_request_deadline(request.header->deadline);
+        int status = execute_request(&request, client);
+        set_request_deadline(0);
+
+        if (status == TECNICOFS_ERROR_TIMEOUT) __atomic_add_fetch(&expired_requests, 1, __ATOMIC_RELAXED);
+
+        /* sends report back to client */
+        if (request.header->opcode == OP_PRINT_CHANGES && status == SUCCESS)
+            send_response(client, request.header, status, &request.seq, sizeof(request.seq));
+        else if (! answers_itself(request.header->opcode))
+            send_response(client, request.header, status, NULL, 0);
+    }
+
+    /* a region that was attached stays mapped without its descriptor */
+    if (client->passed_fd != -1) {
+        close(client->passed_fd);
+        client->passed_fd = -1;
+    }
+
+    __atomic_add_fetch(&handled_requests, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Takes the oldest request of a shared memory session, copying it out of the ring so the
+ * client can't change it while it is handled. The tail and sizes come from the client, so
+ * they are checked against the room the ring really has.
+ *
+ * Input:
+ *   - ring: request ring of the session
+ *   - message: gets the request, TFS_MAX_MESSAGE bytes
+ *   - size: gets the size of the request
+ * Output:
+ *   - 1 if a request was taken, 0 if the ring is empty or FAIL if its contents are invalid
+ * */
+int shm_take(tfs_shm_ring *ring, char *message, uint32_t *size) {
+
+    while (1) {
+        uint32_t used = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - shm_request_head;
+        if (used == 0) return 0;
+        if (used > TFS_SHM_RING_SIZE) return FAIL;
+
+        /* the head only moves by whole records, so the size always lies inside the ring */
+        uint32_t offset = shm_request_head & (TFS_SHM_RING_SIZE - 1);
+        *size = __atomic_load_n((uint32_t *) (ring->data + offset), __ATOMIC_RELAXED);
+
+        if (*size == TFS_SHM_WRAP) {
+            if (TFS_SHM_RING_SIZE - offset > used) return FAIL;
+            shm_request_head += TFS_SHM_RING_SIZE - offset;
+            __atomic_store_n(&ring->head, shm_request_head, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if (*size > TFS_MAX_MESSAGE || offset + 8 + *size > TFS_SHM_RING_SIZE || TFS_SHM_RECORD(*size) > used)
+            return FAIL;
+
+        memcpy(message, ring->data + offset + 8, *size);
+        shm_request_head += TFS_SHM_RECORD(*size);
+        __atomic_store_n(&ring->head, shm_request_head, __ATOMIC_RELEASE);
+        return 1;
+    }
+}
+
+
+/*
+ * Serves a shared memory session until the client closes it, dies or breaks the rings. Requests
+ * are answered in the response ring; the thread only sleeps when the session has been idle for
+ * a while, so a busy client never waits for a system call.
+ *
+ * Input:
+ *   - ptr: session set up by attach_shm_session, freed here
+ * */
+void *shm_session_thread(void *ptr) {
+
+    shm_session *session = ptr;
+    tfs_shm_region *region = session->region;
+    tfs_client client;
+
+    shm_client_pid = session->client_pid;
+    free(session);
+
+    /* holds each request while it is handled. TFS_MAX_MESSAGE keeps it aligned for the header */
+    char *message = malloc(TFS_MAX_MESSAGE);
+
+    bzero(&client, sizeof(client));
+    client.fd = -1;
+    client.passed_fd = -1;
+    client.shm = region;
+    shm_spin = tfs_shm_spin_start();
+
+    /* rings start empty and records are 8 byte aligned, which the positions must respect */
+    shm_request_head = __atomic_load_n(&region->requests.head, __ATOMIC_ACQUIRE);
+    shm_response_tail = __atomic_load_n(&region->responses.tail, __ATOMIC_ACQUIRE);
+    int valid = message != NULL && (shm_request_head & 7) == 0 && (shm_response_tail & 7) == 0;
+
+    while (valid) {
+        uint32_t seen = __atomic_load_n(&region->server_bell.seq, __ATOMIC_ACQUIRE);
+        uint32_t size;
+        int res = shm_take(&region->requests, message, &size);
+
+        if (res == FAIL) break;
+        if (res == 0) {
+            if (__atomic_load_n(&region->closed, __ATOMIC_ACQUIRE)) break;
+            if (! tfs_shm_wait(&region->server_bell, seen, &shm_spin) && ! shm_client_alive(region)) break;
+            continue;
+        }
+
+        /* the request left the ring, so the client may already use its room */
+        tfs_shm_ring_bell(&region->client_bell);
+        handle_message(message, size, &client);
+    }
+
+    free(message);
+    munmap(region, sizeof(tfs_shm_region));
+    return NULL;
+}
+
+
+/*
+ * Applies commands received on the datagram socket. Each recvmmsg takes every message already
+ * waiting, up to DGRAM_BATCH, so under heavy load a thread handles many requests per system
+ * call; their replies are then sent together with sendmmsg. When the socket is idle it returns
+ * as soon as one message arrives, so requests aren't delayed waiting for others.
+ */
+void applyCommands() {
+
+    tfs_client clients[DGRAM_BATCH];  /* clients that sent each message */
+    struct iovec iov[DGRAM_BATCH];
+    struct mmsghdr msgs[DGRAM_BATCH];
+    union {
+        struct cmsghdr align;
+        char bytes[FD_CONTROL_SIZE];
+    } controls[DGRAM_BATCH];  /* descriptors passed with each message */
+
+    /* holds the messages with the requests. TFS_MAX_MESSAGE keeps each one aligned for the header */
+    char *messages = malloc(DGRAM_BATCH * TFS_MAX_MESSAGE);
+    reply_batch *replies = malloc(sizeof(reply_batch));
+    assert__(messages != NULL && replies != NULL, "Error: couldn't allocate receive buffers!\n")
+
+    replies->count = 0;
+    pending_replies = replies;
+
+    for (int i = 0; i < DGRAM_BATCH; i++) {
+        clients[i].fd = server_socket_fd;
+        clients[i].shm = NULL;
+        iov[i].iov_base = messages + i * TFS_MAX_MESSAGE;
+        iov[i].iov_len = TFS_MAX_MESSAGE;
+    }
+
+    /* loop until file has reached it's end */
+    while (1) {
+
+        for (int i = 0; i < DGRAM_BATCH; i++) {
+            bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_name = &clients[i].addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);  /* gets standard size of socket address */
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i].bytes;
+            msgs[i].msg_hdr.msg_controllen = FD_CONTROL_SIZE;
+        }
+
+        /* receives messages and gets how many were read */
+        int n = recvmmsg(server_socket_fd, msgs, DGRAM_BATCH, MSG_WAITFORONE, NULL);
+
+        for (int i = 0; i < n; i++) {
+            clients[i].passed_fd = take_passed_fd(&msgs[i].msg_hdr, &clients[i].pid);
+            if (msgs[i].msg_len == 0) {  /* if inputs is invalid, continues */
+                if (clients[i].passed_fd != -1) close(clients[i].passed_fd);
+                continue;
+            }
+
+            clients[i].addrlen = msgs[i].msg_hdr.msg_namelen;
+            handle_message(iov[i].iov_base, msgs[i].msg_len, &clients[i]);
+        }
+
+        flush_replies(replies);
+    }
+}
+
+
+/*
+ * Adds the multishot receive to a ring. It completes once per message, each in a
+ * buffer picked from the registered group, until the kernel ends it.
+ *
+ * Input:
+ *   - ring: ring that receives
+ *   - header: where the kernel learns the size of the address to receive; lives as long as the ring
+ * */
+void uring_arm_receive(uring *ring, struct msghdr *header) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL) {
+        uring_submit(ring, 0);
+        sqe = uring_get_sqe(ring);
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = server_socket_fd;
+    sqe->addr = (unsigned long) header;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_RECEIVE;
+}
+
+
+/*
+ * Queues the replies held back by a worker as sends in its ring, submitted with its next wait.
+ * If every slot is taken, the reply is sent right away instead.
+ *
+ * Input:
+ *   - ring: ring of the worker
+ *   - replies: replies held back
+ *   - slots: reply slots of the worker
+ *   - free_slot: first free slot
+ * */
+void uring_queue_replies(uring *ring, reply_batch *replies, uring_reply *slots, int *free_slot) {
+
+    for (int i = 0; i < replies->count; i++) {
+        struct io_uring_sqe *sqe = NULL;
+
+        if (*free_slot != -1 && (sqe = uring_get_sqe(ring)) == NULL) {
+            uring_submit(ring, 0);
+            sqe = uring_get_sqe(ring);
+        }
+        if (sqe == NULL) {
+            sendmsg(server_socket_fd, &replies->msgs[i].msg_hdr, MSG_NOSIGNAL);
+            continue;
+        }
+
+        uring_reply *reply = &slots[*free_slot];
+        sqe->user_data = *free_slot;
+        *free_slot = reply->next_free;
+
+        reply->header = replies->headers[i];
+        reply->addr = replies->addrs[i];
+        reply->iov.iov_base = &reply->header;
+        reply->iov.iov_len = sizeof(tfs_response_header);
+        reply->msg = replies->msgs[i].msg_hdr;
+        reply->msg.msg_name = &reply->addr;
+        reply->msg.msg_iov = &reply->iov;
+
+        /* the kernel never wakes a send waiting for room in a client's queue on an unconnected
+         * socket, so sends don't wait there; the ones that would are redone when they complete */
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = server_socket_fd;
+        sqe->addr = (unsigned long) &reply->msg;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+    }
+
+    replies->count = 0;
+}
+
+
+/*
+ * Hands a request taken from the ring to the workers of the io_uring engine. Waits while they
+ * have URING_QUEUE_SIZE requests queued, which leaves the rest waiting in the socket.
+ *
+ * Input:
+ *   - message: message with the request
+ *   - size: bytes of the message
+ *   - client: client that sent it. its passed descriptor goes with the request
+ * */
+void uring_dispatch_request(char *message, int size, tfs_client *client) {
+    staged_request *request = malloc(sizeof(staged_request) + size);
+
+    /* without memory the request is dropped, as the socket would have done */
+    if (request == NULL) return;
+
+    request->client = *client;
+    request->size = size;
+    memcpy(request->message, message, size);
+    client->passed_fd = -1;
+    mpmc_push(&uring_queue, request);
+}
+
+
+/*
+ * Applies commands received on the datagram socket through an io_uring ring. A multishot
+ * receive delivers the requests into registered buffers without a system call per message, and
+ * the replies of everything handled are submitted along with the next wait, so a busy thread
+ * makes one system call per round instead of two per request. Only one ring receives, since
+ * every multishot receive on the socket is woken for each message: with one worker it also
+ * executes the requests, otherwise it hands them to the workers.
+ *
+ * Input:
+ *   - dispatch: 1 to queue the requests for the workers instead of executing them
+ * Returns: FAIL if the kernel has no io_uring or lacks the features used (nothing was received
+ *          then), never returns otherwise
+ * */
+int applyCommandsUring(int dispatch) {
+
+    uring ring;
+    uring_buffers buffers;
+
+    if (uring_init(&ring, URING_ENTRIES) == FAIL) return FAIL;
+    if (uring_buffers_register(&ring, &buffers, 0, URING_BUFFERS, URING_BUFFER_SIZE) == FAIL) {
+        uring_destroy(&ring);
+        return FAIL;
+    }
+
+    uring_reply *slots = malloc(URING_REPLIES * sizeof(uring_reply));
+    reply_batch *replies = malloc(sizeof(reply_batch));
+    assert__(slots != NULL && replies != NULL, "Error: couldn't allocate io_uring replies!\n")
+
+    int free_slot = 0;
+    for (int i = 0; i < URING_REPLIES; i++) slots[i].next_free = i + 1 < URING_REPLIES ? i + 1 : -1;
+
+    replies->count = 0;
+    pending_replies = replies;
+
+    struct msghdr header;
+    bzero(&header, sizeof(header));
+    header.msg_namelen = URING_NAME_SIZE;
+    header.msg_controllen = FD_CONTROL_SIZE;
+
+    tfs_client client;  /* client that sent the request */
+    client.fd = server_socket_fd;
+    client.shm = NULL;
+
+    int received = 0;  /* 1 once a message arrives, proving the kernel supports the receive */
+
+    uring_arm_receive(&ring, &header);
+
+    while (1) {
+        uring_submit(&ring, 1);
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            __u64 data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&ring);
+
+            /* a reply was sent, or the client is gone. either way its slot is free again. a full
+             * client queue throttles the worker, as in the classic engine */
+            if (data != URING_RECEIVE) {
+                if (res == -EAGAIN) sendmsg(server_socket_fd, &slots[data].msg, MSG_NOSIGNAL);
+                slots[data].next_free = free_slot;
+                free_slot = (int) data;
+                continue;
+            }
+
+            if (res < 0 && res != -ENOBUFS && ! received) {
+                uring_buffers_unregister(&ring, &buffers);
+                uring_destroy(&ring);
+                free(slots);
+                free(replies);
+                pending_replies = NULL;
+                return FAIL;
+            }
+
+            if (res >= 0 && (flags & IORING_CQE_F_BUFFER)) {
+                unsigned short id = flags >> IORING_CQE_BUFFER_SHIFT;
+                char *buffer = uring_buffer(&buffers, id);
+                struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+                char *control = buffer + sizeof(struct io_uring_recvmsg_out) + URING_NAME_SIZE;
+                char *message = control + FD_CONTROL_SIZE;
+
+                struct msghdr passed;  /* the control data as recvmsg would have returned it */
+                bzero(&passed, sizeof(passed));
+                passed.msg_control = control;
+                passed.msg_controllen = out->controllen;
+                client.passed_fd = take_passed_fd(&passed, &client.pid);
+
+                received = 1;
+                client.addrlen = out->namelen < sizeof(struct sockaddr_un) ? out->namelen : sizeof(struct sockaddr_un);
+                memcpy(&client.addr, buffer + sizeof(struct io_uring_recvmsg_out), client.addrlen);
+
+                /* buffers hold the largest message a client sends, so this only drops bad ones */
+                if (out->flags & MSG_TRUNC) {
+                    if (out->payloadlen >= sizeof(tfs_request_header))
+                        send_response(&client, (tfs_request_header *) message, TECNICOFS_ERROR_OTHER, NULL, 0);
+                }
+                else if (out->payloadlen > 0 && dispatch) uring_dispatch_request(message, out->payloadlen, &client);
+                else if (out->payloadlen > 0) handle_message(message, out->payloadlen, &client);
+                if (client.passed_fd != -1) close(client.passed_fd);
+
+                uring_buffer_return(&buffers, id);
+                if (replies->count == DGRAM_BATCH) uring_queue_replies(&ring, replies, slots, &free_slot);
+            }
+
+            /* the receive ends when it runs out of buffers or fails, and is armed again */
+            if (! (flags & IORING_CQE_F_MORE)) uring_arm_receive(&ring, &header);
+        }
+
+        uring_queue_replies(&ring, replies, slots, &free_slot);
+    }
+}
+
+
+/*
+ * Receives the requests of the io_uring engine when it has more than one worker. If the kernel
+ * has no io_uring, the workers are told to fall back to the classic engine.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *receiveRequestsUring(void *ptr) {
+    if (applyCommandsUring(1) == FAIL) {
+        fprintf(stderr, "Warning: io_uring unavailable, using the classic engine\n");
+        for (int i = 0; i < numberThreads; i++) mpmc_push(&uring_queue, &uring_fallback_request);
+    }
+    return NULL;
+}
+
+
+/*
+ * Executes the requests taken from the ring by receiveRequestsUring. Replies without payload
+ * are held back while more requests are queued, and sent together with sendmmsg once there are
+ * none.
+ * */
+void applyDispatchedCommands() {
+
+    reply_batch *replies = malloc(sizeof(reply_batch));
+    assert__(replies != NULL, "Error: couldn't allocate replies!\n")
+
+    replies->count = 0;
+    pending_replies = replies;
+
+    while (1) {
+        staged_request *request = mpmc_try_pop(&uring_queue);
+        if (request == NULL) {
+            flush_replies(replies);
+            request = mpmc_pop(&uring_queue);
+        }
+
+        if (request == &uring_fallback_request) {
+            flush_replies(replies);
+            pending_replies = NULL;
+            free(replies);
+            applyCommands();
+            return;
+        }
 
-/* number of threads executing a client request */
-int in_execution = 0;
+        handle_message(request->message, request->size, &request->client);
+        free(request);
+    }
+}
 
-/* used to signal when a thread is writing contents in a file */
-int is_printing = 0;
 
-/* used to lock when checking if client inserted a print request */
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cond_print = PTHREAD_COND_INITIALIZER;
-pthread_cond_t cond_wait = PTHREAD_COND_INITIALIZER;
+/*
+ * Lock wait hook of the coroutine engine. The deadline of the request is kept by the thread, so
+ * it is saved while other coroutines run theirs.
+ * */
+void yield_task() {
+    uint32_t deadline = request_deadline;
+    coroutine_yield();
+    set_request_deadline(deadline);
+}
 
 
 /*
- * Sets socket address and inits everything.
+ * Runs the request of a task, inside its coroutine.
  *
  * Input:
- *   - path: socket path
- *   - addr: socket address
+ *   - ptr: task
+ * */
+void run_task(void *ptr) {
+    coroutine_task *task = ptr;
+    handle_message(task->message, task->size, &task->client);
+}
+
+
+/*
+ * Applies commands received on the datagram socket, each one in a coroutine of its own, so a
+ * single thread runs up to worker_coroutines requests at once. A request that finds an i-node
+ * lock busy yields to the others instead of blocking the thread, and is resumed on the next
+ * pass. New requests are only waited for when the thread has nothing else to run, and when
+ * every task has waited for locks for COROUTINE_IDLE_PASSES passes the thread sleeps between
+ * passes instead of spinning.
+ */
+void applyCoroutineCommands() {
+
+    coroutine_task *tasks = malloc(worker_coroutines * sizeof(coroutine_task));
+    int *free_tasks = malloc(worker_coroutines * sizeof(int));  /* tasks without a request */
+    int *active = malloc(worker_coroutines * sizeof(int));  /* tasks running a request */
+    char *messages = malloc((size_t) worker_coroutines * TFS_MAX_MESSAGE);
+    reply_batch *replies = malloc(sizeof(reply_batch));
+    assert__(tasks != NULL && free_tasks != NULL && active != NULL && messages != NULL && replies != NULL,
+             "Error: couldn't allocate coroutine tasks!\n")
+
+    for (int i = 0; i < worker_coroutines; i++) {
+        assert__(coroutine_init(&tasks[i].co, COROUTINE_STACK_SIZE) == SUCCESS, "Error: couldn't allocate a coroutine stack!\n")
+        tasks[i].client.fd = server_socket_fd;
+        tasks[i].client.shm = NULL;
+        tasks[i].message = messages + (size_t) i * TFS_MAX_MESSAGE;
+        free_tasks[i] = i;
+    }
+    int free_count = worker_coroutines, active_count = 0;
+
+    struct iovec iov[DGRAM_BATCH];
+    struct mmsghdr msgs[DGRAM_BATCH];
+    union {
+        struct cmsghdr align;
+        char bytes[FD_CONTROL_SIZE];
+    } controls[DGRAM_BATCH];  /* descriptors passed with each message */
+    int picked[DGRAM_BATCH];  /* task given each message */
+
+    replies->count = 0;
+    pending_replies = replies;
+
+    /* busy locks switch to the next coroutine instead of blocking the thread */
+    tecnicofs_set_lock_wait(yield_task);
+
+    int idle_passes = 0;  /* passes in a row in which no task got anywhere */
+    struct pollfd readable = { server_socket_fd, POLLIN, 0 };
+
+    while (1) {
+        int want = free_count < DGRAM_BATCH ? free_count : DGRAM_BATCH;
+        int n = 0;
+
+        if (want > 0) {
+            for (int i = 0; i < want; i++) {
+                coroutine_task *task = &tasks[picked[i] = free_tasks[free_count - 1 - i]];
+                iov[i].iov_base = task->message;
+                iov[i].iov_len = TFS_MAX_MESSAGE;
+
+                bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+                msgs[i].msg_hdr.msg_name = &task->client.addr;
+                msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = controls[i].bytes;
+                msgs[i].msg_hdr.msg_controllen = FD_CONTROL_SIZE;
+            }
+
+            /* with nothing to run it waits for a request, otherwise it only takes those waiting */
+            n = recvmmsg(server_socket_fd, msgs, want, active_count == 0 ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+            if (n < 0) n = 0;
+        }
+
+        free_count -= n;
+        for (int i = 0; i < n; i++) {
+            coroutine_task *task = &tasks[picked[i]];
+
+            task->client.passed_fd = take_passed_fd(&msgs[i].msg_hdr, &task->client.pid);
+            if (msgs[i].msg_len == 0) {  /* if inputs is invalid, continues */
+                if (task->client.passed_fd != -1) close(task->client.passed_fd);
+                free_tasks[free_count++] = picked[i];
+                continue;
+            }
+
+            task->client.addrlen = msgs[i].msg_hdr.msg_namelen;
+            task->size = msgs[i].msg_len;
+            coroutine_start(&task->co, run_task, task);
+            active[active_count++] = picked[i];
+        }
+
+        /* runs every task once, until it ends or finds a lock busy */
+        int progress = n > 0;
+        for (int i = 0; i < active_count;) {
+            int id = active[i];
+            if (coroutine_resume(&tasks[id].co)) {
+                active[i] = active[--active_count];
+                free_tasks[free_count++] = id;
+                progress = 1;
+            }
+            else i++;
+        }
+
+        flush_replies(replies);
+
+        /* every task waits for a lock held by another thread, which needs a CPU to release it.
+         * a lock held for long makes the worker sleep instead, until a request arrives or the
+         * lock had time to be released */
+        if (active_count == 0 || progress) idle_passes = 0;
+        else if (++idle_passes < COROUTINE_IDLE_PASSES) sched_yield();
+        else poll(&readable, free_count > 0 ? 1 : 0, COROUTINE_IDLE_MS);
+    }
+}
+
+
+/*
+ * Drops a reference to a connection, closing it when it was the last one.
+ *
+ * Input:
+ *   - conn: connection
+ * */
+void connection_release(connection *conn) {
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(conn->fd);
+        free(conn);
+    }
+}
+
+
+/*
+ * Adds a request to the work queue, waiting while it is full. A full queue stops the epoll
+ * thread from reading, so clients are throttled by their socket buffers.
+ *
+ * Input:
+ *   - item: request read from a connection
+ * */
+void work_push(work_item item) {
+    pthread_mutex_lock(&work_lock);
+    while (work_count == WORK_QUEUE_SIZE) pthread_cond_wait(&work_not_full, &work_lock);
+
+    work_queue[(work_head + work_count) % WORK_QUEUE_SIZE] = item;
+    work_count++;
+
+    pthread_cond_signal(&work_not_empty);
+    pthread_mutex_unlock(&work_lock);
+}
+
+
+/*
+ * Takes the oldest request from the work queue, waiting while it is empty.
+ *
  * Output:
- *   - size of socket
+ *   - request read from a connection
  * */
-int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
+work_item work_pop() {
+    pthread_mutex_lock(&work_lock);
+    while (work_count == 0) pthread_cond_wait(&work_not_empty, &work_lock);
 
-    if (addr == NULL) return 0;  /* interrupts if address is invalid */
+    work_item item = work_queue[work_head];
+    work_head = (work_head + 1) % WORK_QUEUE_SIZE;
+    work_count--;
 
-    bzero((char *)addr, sizeof(struct sockaddr_un));  /* clears possible values in addr variable */
-    addr->sun_family = AF_UNIX;  /* sets socket domain as unix */
-    strcpy(addr->sun_path, path);  /* copies path to the socket */
+    pthread_cond_signal(&work_not_full);
+    pthread_mutex_unlock(&work_lock);
+    return item;
+}
 
-    return SUN_LEN(addr);
+
+/*
+ * Accepts the connections waiting on the listening socket and registers them in epoll.
+ *
+ * Input:
+ *   - epoll_fd: epoll instance of the server
+ * */
+void accept_connections(int epoll_fd) {
+    int fd;
+
+    /* the listening socket is non blocking, so this stops once no connection is waiting */
+    while ((fd = accept(server_socket_fd, NULL, NULL)) != -1) {
+        connection *conn = malloc(sizeof(connection));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) connection_release(conn);
+    }
+}
+
+
+/*
+ * Reads the next request of a ready connection and hands it to the workers. Only one request
+ * is read per connection each time epoll reports it, so busy clients can't starve the others.
+ * A connection that was closed or failed is removed.
+ *
+ * Input:
+ *   - epoll_fd: epoll instance of the server
+ *   - conn: ready connection
+ *   - buffer: buffer with TFS_MAX_MESSAGE bytes
+ * */
+void read_connection(int epoll_fd, connection *conn, char *buffer) {
+
+    union {
+        struct cmsghdr align;
+        char bytes[FD_CONTROL_SIZE];
+    } control;
+    struct iovec iov = { buffer, TFS_MAX_MESSAGE };
+    struct msghdr msg;
+
+    bzero(&msg, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = FD_CONTROL_SIZE;
+
+    int c = recvmsg(conn->fd, &msg, MSG_DONTWAIT);
+    int passed_fd = c >= 0 ? take_passed_fd(&msg, NULL) : -1;
+
+    if (c > 0) {
+        work_item item = { conn, malloc(c), c, passed_fd };
+        if (item.message == NULL) {  /* the client gets no answer, as if the request was lost */
+            if (passed_fd != -1) close(passed_fd);
+            return;
+        }
+
+        memcpy(item.message, buffer, c);
+        __atomic_add_fetch(&conn->refs, 1, __ATOMIC_RELAXED);
+        work_push(item);
+    }
+    else if (c == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        /* the client is gone. requests already queued are still answered */
+        if (passed_fd != -1) close(passed_fd);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        connection_release(conn);
+    }
 }
 
 
 /*
- * Applies commands from input file
+ * Waits for connection events and feeds the work queue. Only this thread reads from the
+ * sockets, so workers never wake up without a request to execute.
  */
-void applyCommands() {
+void serveConnections() {
 
-    struct sockaddr_un client_addr;  /* client socket address */
-    int c;  /* holds number of bytes read */
+    struct epoll_event events[EPOLL_EVENTS];
+    char *buffer = malloc(TFS_MAX_MESSAGE);
+    int epoll_fd = epoll_create1(0);
 
-    socklen_t addrlen = sizeof(struct sockaddr_un);  /* gets standard size of socket address */
+    assert__(buffer != NULL && epoll_fd != -1, "Error: couldn't create epoll instance!\n")
 
-    char command[MAX_INPUT_SIZE];  /* holds command that is going to be executed */
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    assert__(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket_fd, &event) != -1, "Error: couldn't watch server socket!\n")
 
-    int output[1];  /* holds command output after execution. uses an array for simplicity */
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, EPOLL_EVENTS, -1);
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) accept_connections(epoll_fd);
+            else read_connection(epoll_fd, events[i].data.ptr, buffer);
+        }
+    }
+}
+
+
+/*
+ * Executes the requests read by serveConnections
+ */
+void applyQueuedCommands() {
+
+    tfs_client client;
+    client.addrlen = 0;  /* answers go through the connection */
+    client.shm = NULL;
 
-    /* loop until file has reached it's end */
     while (1) {
+        work_item item = work_pop();
+        if (item.conn == NULL) return;  /* the pool has shrunk */
 
-        /* receives message and gets number of bytes read */
-        c = recvfrom(server_socket_fd, command, sizeof(command) - 1, 0,
-                     (struct sockaddr *) &client_addr, &addrlen);
+        client.fd = item.conn->fd;
+        client.passed_fd = item.passed_fd;
+        handle_message(item.message, item.size, &client);
 
-        if (c <= 0) continue;  /* if inputs is invalid, continues */
+        free(item.message);
+        connection_release(item.conn);
+    }
+}
 
-        command[c] = '\0';  /* prevents client message from not having a '\0' */
 
-        char token;
-        char name_2[MAX_INPUT_SIZE];
-        char name_1[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %s", &token, name_1, name_2);
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
-        }
+/*
+ * Takes the next request for a worker of the staged engine, waiting while there is none. The
+ * class whose turn it is goes first; if it has nothing, the others are tried in order.
+ *
+ * Output:
+ *   - request
+ * */
+staged_request *staged_pop() {
+    static const int schedule[CLASS_TURNS] = CLASS_SCHEDULE;
 
-        assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
+    /* every post is a request pushed before it, so one is there for each wait */
+    while (sem_wait(&execute_ready) != 0) {}
 
-        /* when we detect a 'p' command, this variable is set to 1 and thus, all subsequent threads
-         * will wait in here until the command is concluded before proceeding */
-        while (is_printing)
-            pthread_cond_wait(&cond_print, &lock);
+    int first = schedule[class_turn];
+    class_turn = (class_turn + 1) % CLASS_TURNS;
 
-        /* when a 'p' command is detected, we need to inform the other threads that we have this
-         * pending command and after that, we wait until all threads finish their execution */
-        if (token == 'p') {
-            is_printing++;
-            while(in_execution > 0)
-                pthread_cond_wait(&cond_wait, &lock);
-        }
+    while (1) {
+        staged_request *request = mpmc_try_pop(&execute_queues[first]);
+        if (request != NULL) return request;
 
-        in_execution++;  /* signals that we have one more thread in execution */
+        for (int c = 0; c < CLASSES; c++)
+            if (c != first && (request = mpmc_try_pop(&execute_queues[c])) != NULL) return request;
+    }
+}
 
-        assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
 
-        switch (token) {
-            case 'c':
+/*
+ * Receive stage of the staged engine: reads requests from the datagram socket, as many at once
+ * as recvmmsg gives, and queues each one in its class for the workers. A class that is full
+ * gets TECNICOFS_ERROR_BUSY right away, so a burst of one kind of request can't make the others
+ * wait behind it nor queue without bound.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *receiveRequests(void *ptr) {
 
-                switch (name_2[0]) {
-                    case 'f':
-                        printf("Create file: %s\n", name_1);
-                        output[0] = create(name_1, T_FILE);
-                        break;
-                    case 'd':
-                        printf("Create directory: %s\n", name_1);
-                        output[0] = create(name_1, T_DIRECTORY);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                }
-                break;
+    struct sockaddr_un addrs[DGRAM_BATCH];
+    struct iovec iov[DGRAM_BATCH];
+    struct mmsghdr msgs[DGRAM_BATCH];
+    union {
+        struct cmsghdr align;
+        char bytes[FD_CONTROL_SIZE];
+    } controls[DGRAM_BATCH];
 
-            case 'l':
-                output[0] = lookup(name_1);
-                if (output[0] >= 0) printf("Search: %s found\n", name_1);
-                else printf("Search: %s not found\n", name_1);
-                break;
+    char *messages = malloc(DGRAM_BATCH * TFS_MAX_MESSAGE);
+    assert__(messages != NULL, "Error: couldn't allocate receive buffers!\n")
 
-            case 'd':
-                printf("Delete: %s\n", name_1);
-                output[0] = delete(name_1);
-                break;
+    for (int i = 0; i < DGRAM_BATCH; i++) {
+        iov[i].iov_base = messages + i * TFS_MAX_MESSAGE;
+        iov[i].iov_len = TFS_MAX_MESSAGE;
+    }
 
-            case 'm':
-                printf("Move: %s\n", name_1);
-                output[0] = move(name_1, name_2);
-                break;
+    while (1) {
 
-            case 'p':
-                printf("Print: %s\n", name_1);
-                output[0] = print_tecnicofs_tree(name_1);
+        for (int i = 0; i < DGRAM_BATCH; i++) {
+            bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i].bytes;
+            msgs[i].msg_hdr.msg_controllen = FD_CONTROL_SIZE;
+        }
 
-                assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
-                /* printing has finished and signals other threads of this event */
-                is_printing--; pthread_cond_broadcast(&cond_print);
-                assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
-                break;
+        int n = recvmmsg(server_socket_fd, msgs, DGRAM_BATCH, MSG_WAITFORONE, NULL);
+
+        for (int i = 0; i < n; i++) {
+            pid_t pid;
+            int passed_fd = take_passed_fd(&msgs[i].msg_hdr, &pid);
+            staged_request *request = msgs[i].msg_len > 0 ? malloc(sizeof(staged_request) + msgs[i].msg_len) : NULL;
 
-            default: { /* error */
-                fprintf(stderr, "Error: command to apply\n");
-                exit(EXIT_FAILURE);
+            /* without memory the request is dropped, as the socket would have done */
+            if (request == NULL) {
+                if (passed_fd != -1) close(passed_fd);
+                continue;
             }
 
+            request->client.fd = server_socket_fd;
+            request->client.addrlen = msgs[i].msg_hdr.msg_namelen;
+            memcpy(&request->client.addr, &addrs[i], request->client.addrlen);
+            request->client.passed_fd = passed_fd;
+            request->client.pid = pid;
+            request->client.shm = NULL;
+            request->size = msgs[i].msg_len;
+            memcpy(request->message, iov[i].iov_base, msgs[i].msg_len);
+
+            /* a full class is told to come back later instead of holding up the others */
+            if (mpmc_try_push(&execute_queues[request_class(request->message, request->size)], request) == FAIL) {
+                __atomic_add_fetch(&rejected_requests, 1, __ATOMIC_RELAXED);
+                if (request->size >= (int) sizeof(tfs_request_header))
+                    send_response(&request->client, (tfs_request_header *) request->message, TECNICOFS_ERROR_BUSY, NULL, 0);
+                if (passed_fd != -1) close(passed_fd);
+                free(request);
+                continue;
+            }
+            sem_post(&execute_ready);
         }
+    }
+}
 
-        /* sends report back to client */
-        sendto(server_socket_fd, output, sizeof(output), 0, (struct sockaddr *) &client_addr, addrlen);
 
-        assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
-        in_execution--;
-        pthread_cond_signal(&cond_wait);
-        assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
+/*
+ * Execute stage of the staged engine: runs the queued requests and hands their replies to the
+ * reply stage, so workers only ever wait for the file system.
+ */
+void applyStagedCommands() {
+
+    staged_replies = 1;
+
+    while (1) {
+        staged_request *request = staged_pop();
+        if (request == &retire_request) return;  /* the pool has shrunk */
+        handle_message(request->message, request->size, &request->client);
+        free(request);
+    }
+}
+
+
+/*
+ * Reply stage of the staged engine: sends the queued replies, as many at once as are waiting
+ * (up to DGRAM_BATCH), with sendmmsg.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *sendReplies(void *ptr) {
+
+    staged_reply *replies[DGRAM_BATCH];
+    struct iovec iov[DGRAM_BATCH][2];
+    struct mmsghdr msgs[DGRAM_BATCH];
+
+    while (1) {
+        int count = 0;
+
+        /* waits for one reply, then takes whatever else is already there */
+        replies[count++] = mpmc_pop(&reply_queue);
+        while (count < DGRAM_BATCH && (replies[count] = mpmc_try_pop(&reply_queue)) != NULL) count++;
 
+        for (int i = 0; i < count; i++) {
+            iov[i][0].iov_base = &replies[i]->header;
+            iov[i][0].iov_len = sizeof(tfs_response_header);
+            iov[i][1].iov_base = replies[i]->payload;
+            iov[i][1].iov_len = replies[i]->header.size;
+
+            bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_name = &replies[i]->addr;
+            msgs[i].msg_hdr.msg_namelen = replies[i]->addrlen;
+            msgs[i].msg_hdr.msg_iov = iov[i];
+            msgs[i].msg_hdr.msg_iovlen = replies[i]->header.size > 0 ? 2 : 1;
+        }
+
+        int sent = 0;
+        while (sent < count) {
+            int c = sendmmsg(server_socket_fd, msgs + sent, count - sent, MSG_NOSIGNAL);
+            if (c > 0) sent += c;
+            else if (errno != EINTR) sent++;  /* the client of the first reply is gone, skips it */
+        }
+
+        for (int i = 0; i < count; i++) free(replies[i]);
     }
 }
 
 
 /* auxiliary function used to redirect a thread to the applyCommands function */
 void *applyCommand_thread(void* ptr) {
-    applyCommands();
+    pin_thread(__atomic_fetch_add(&next_pinned, 1, __ATOMIC_RELAXED));
+
+    if (transport == TRANSPORT_SEQPACKET) applyQueuedCommands();
+    else if (engine == ENGINE_STAGED) applyStagedCommands();
+    else if (engine == ENGINE_COROUTINE) applyCoroutineCommands();
+    else if (engine == ENGINE_URING && uring_dispatch) applyDispatchedCommands();
+    else if (engine == ENGINE_URING && applyCommandsUring(0) == FAIL) {
+        fprintf(stderr, "Warning: io_uring unavailable, using the classic engine\n");
+        applyCommands();
+    }
+    else applyCommands();
     return NULL;
 }
 
 
+/*
+ * Adds a worker to the pool. Workers of a pool that changes size are detached, since they may
+ * leave before the end.
+ * */
+void start_worker() {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    assert__(pthread_create(&thread, &attr, applyCommand_thread, NULL) == 0, "Error: couldn't create a thread!\n")
+    pthread_attr_destroy(&attr);
+}
+
+
+/*
+ * Asks one worker to leave the pool. The request to leave goes behind the work already queued,
+ * so it is taken by the first worker that runs out of it.
+ * */
+void retire_worker() {
+    if (transport == TRANSPORT_SEQPACKET) {
+        work_item item = { NULL, NULL, 0, -1 };
+        work_push(item);
+    }
+    else {
+        mpmc_push(&execute_queues[CLASS_READ], &retire_request);
+        sem_post(&execute_ready);
+    }
+}
+
+
+/*
+ * Resizes the worker pool between pool_min and pool_max, once every POOL_INTERVAL_MS. Threads
+ * are added while requests wait in the queue, as long as the last change didn't lower the number
+ * of requests handled; once it does, the pool steps back the other way, so it climbs towards the
+ * size that handles the most requests. More threads are not added when the CPUs are already
+ * busy, the pool shrinks while its threads spend most of their time blocked on i-node locks, and
+ * it drops idle threads after the queue stays empty for POOL_IDLE_TICKS.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *poolController(void *ptr) {
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long last_handled = 0, last_rate = 0, last_wait = tecnicofs_lock_wait_time(), last_cpu = 0;
+    int step = 1, idle_ticks = 0;
+    struct rusage usage;
+
+    while (1) {
+        usleep(POOL_INTERVAL_MS * 1000);
+
+        int workers = __atomic_load_n(&numberThreads, __ATOMIC_RELAXED);
+        int depth = transport == TRANSPORT_SEQPACKET ? __atomic_load_n(&work_count, __ATOMIC_RELAXED) : staged_depth();
+
+        long handled = __atomic_load_n(&handled_requests, __ATOMIC_RELAXED);
+        long rate = handled - last_handled;
+        last_handled = handled;
+
+        /* share of the workers' time spent blocked on locks, and of the CPUs' time used */
+        long wait = tecnicofs_lock_wait_time();
+        double wait_share = (double) (wait - last_wait) / ((double) POOL_INTERVAL_MS * 1000000 * workers);
+        last_wait = wait;
+
+        getrusage(RUSAGE_SELF, &usage);
+        long cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        double cpu_share = (double) (cpu - last_cpu) / ((double) POOL_INTERVAL_MS * 1000 * cpus);
+        last_cpu = cpu;
+
+        int change = 0;
+        idle_ticks = depth == 0 ? idle_ticks + 1 : 0;
+
+        if (idle_ticks >= POOL_IDLE_TICKS) {
+            change = -1;
+            idle_ticks = 0;
+        }
+        else if (depth > 0) {
+            if (wait_share > POOL_MAX_LOCK_WAIT) step = -1;
+            else if (rate < last_rate) step = -step;
+
+            change = step;
+            if (change > 0 && cpu_share > POOL_MAX_CPU) change = 0;
+        }
+        last_rate = rate;
+
+        if (change > 0 && workers < pool_max) {
+            __atomic_add_fetch(&numberThreads, 1, __ATOMIC_RELAXED);
+            start_worker();
+        }
+        else if (change < 0 && workers > pool_min) {
+            __atomic_sub_fetch(&numberThreads, 1, __ATOMIC_RELAXED);
+            retire_worker();
+        }
+    }
+}
+
+
+/*
+ * Reads the optional arguments given after the required ones:
+ *   -t dgram|seqpacket: transport the server listens on (dgram by default)
+ *   -e classic|uring|staged|coroutine: engine serving the datagram transport (classic by default)
+ *   -p receivers,senders: threads of the receive and reply stages of the staged engine (1,1 by
+ *      default). the positional number of threads sizes its execute stage
+ *   -q reads,writes,bulk: requests of each class the staged engine lets wait before turning new
+ *      ones away busy (4096,1024,64 by default, each a power of 2)
+ *   -c coroutines: requests each worker of the coroutine engine runs at once (64 by default)
+ *   -w min,max: lets the worker pool change size between min and max threads, starting from the
+ *      positional number of threads. needs a queue to size it by: seqpacket or the staged engine
+ *   -g normal|thp|hugetlb: pages the file system's memory is mapped with (normal by default)
+ *   -a cpus: pins the workers to a list of CPUs such as 0-3,8, in turn
+ *   -m: lets clients move their sessions to shared memory
+ *   -n: publishes the namespace mirror at <socket>.ns
+ *   -v: writes every request executed to stdout
+ *
+ * Input:
+ *   - argc, argv: command line
+ * */
+void parseOptions(int argc, char* argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:p:q:c:w:g:a:mnv")) != -1) {
+        switch (opt) {
+            case 't':
+                if (strcmp(optarg, "dgram") == 0) transport = TRANSPORT_DGRAM;
+                else if (strcmp(optarg, "seqpacket") == 0) transport = TRANSPORT_SEQPACKET;
+                else assert__(0, "Error: transport must be dgram or seqpacket.\n")
+                break;
+
+            case 'e':
+                if (strcmp(optarg, "classic") == 0) engine = ENGINE_CLASSIC;
+                else if (strcmp(optarg, "uring") == 0) engine = ENGINE_URING;
+                else if (strcmp(optarg, "staged") == 0) engine = ENGINE_STAGED;
+                else if (strcmp(optarg, "coroutine") == 0) engine = ENGINE_COROUTINE;
+                else assert__(0, "Error: engine must be classic, uring, staged or coroutine.\n")
+                break;
+
+            case 'p':
+                assert__(sscanf(optarg, "%d,%d", &receive_threads, &reply_threads) == 2
+                         && receive_threads > 0 && reply_threads > 0, "Error: stage threads must be given as receivers,senders.\n")
+                break;
+
+            case 'q':
+                assert__(sscanf(optarg, "%d,%d,%d", &class_limits[CLASS_READ], &class_limits[CLASS_WRITE], &class_limits[CLASS_BULK]) == 3,
+                         "Error: queue limits must be given as reads,writes,bulk.\n")
+                for (int c = 0; c < CLASSES; c++)
+                    assert__(class_limits[c] >= 2 && (class_limits[c] & (class_limits[c] - 1)) == 0, "Error: queue limits must be powers of 2.\n")
+                break;
+
+            case 'c':
+                worker_coroutines = atoi(optarg);
+                assert__(worker_coroutines > 0, "Error: workers need at least one coroutine.\n")
+                break;
+
+            case 'w':
+                assert__(sscanf(optarg, "%d,%d", &pool_min, &pool_max) == 2 && pool_min > 0 && pool_max >= pool_min,
+                         "Error: pool bounds must be given as min,max.\n")
+                break;
+
+            case 'g':
+                if (strcmp(optarg, "normal") == 0) tecnicofs_set_pages(TECNICOFS_PAGES_NORMAL);
+                else if (strcmp(optarg, "thp") == 0) tecnicofs_set_pages(TECNICOFS_PAGES_THP);
+                else if (strcmp(optarg, "hugetlb") == 0) tecnicofs_set_pages(TECNICOFS_PAGES_HUGETLB);
+                else assert__(0, "Error: pages must be normal, thp or hugetlb.\n")
+                break;
+
+            case 'a':
+                pinned_count = parse_cpu_list(optarg, pinned_cpus);
+                assert__(pinned_count != FAIL, "Error: CPUs must be given as a list such as 0-3,8.\n")
+                break;
+
+            case 'm':
+                shm_sessions = 1;
+                break;
+
+            case 'n':
+                namespace_mirror = 1;
+                break;
+
+            case 'v':
+                log_requests = 1;
+                break;
+
+            default:
+                assert__(0, "Error: usage: tecnicofs numthreads socket [-t dgram|seqpacket] [-e classic|uring|staged|coroutine] [-p receivers,senders] [-q reads,writes,bulk] [-c coroutines] [-w min,max] [-g normal|thp|hugetlb] [-a cpus] [-m] [-n] [-v]\n")
+        }
+    }
+}
+
+
 int main(int argc, char* argv[]) {
 
     int sock_fd;  /* server socket file descriptor */
@@ -180,45 +2265,122 @@ int main(int argc, char* argv[]) {
     struct sockaddr_un server_addr;  /* server socket address */
     socklen_t addrlen;  /* size of server socket */
 
+    /* options can come anywhere in the command line; the required inputs are what's left */
+    parseOptions(argc, argv);
+
     /* checks if the user inserted the correct amount of inputs */
-    assert__(argc == 3, "Error: need 3 inputs.\n")
+    assert__(argc - optind == 2, "Error: need 3 inputs.\n")
 
     /* holds info about each thread id */
-    numberThreads = atoi(argv[1]);
+    numberThreads = atoi(argv[optind]);
     assert__(numberThreads > 0, "Error: program needs to have more than zero threads.\n")
+    if (pool_max > 0) {
+        assert__(numberThreads >= pool_min && numberThreads <= pool_max, "Error: number of threads must be within the pool bounds.\n")
+        assert__(transport == TRANSPORT_SEQPACKET || engine == ENGINE_STAGED, "Error: pool bounds need the seqpacket transport or the staged engine.\n")
+    }
     pthread_t thread_ids[numberThreads];
 
     /* gets server socket name from the command line */
-    char* server_socket_name = argv[2];
+    char* server_socket_name = argv[optind + 1];
 
-    /* creates server side socket */
-    assert__((sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) != -1, "Error: couldn't create server socket!\n")
+    /* creates server side socket. connections are accepted without blocking the epoll thread */
+    if (transport == TRANSPORT_SEQPACKET)
+        sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+    else
+        sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    assert__(sock_fd != -1, "Error: couldn't create server socket!\n")
+
+    /* datagrams carry the credentials of their sender, so shared memory sessions know the client
+     * they belong to. connections get their peer from the socket instead */
+    int passcred = 1;
+    if (shm_sessions && transport == TRANSPORT_DGRAM)
+        assert__(setsockopt(sock_fd, SOL_SOCKET, SO_PASSCRED, &passcred, sizeof(passcred)) != -1, "Error: couldn't ask for client credentials!\n")
+
+    /* clients connect as soon as the socket shows up, and one that is refused takes the server
+     * for a datagram one, so a connection socket is bound under another name and only shows up
+     * once it listens. connections wait in the backlog meanwhile */
+    char bind_name[strlen(server_socket_name) + sizeof(BIND_SUFFIX)];
+    sprintf(bind_name, "%s%s", server_socket_name, transport == TRANSPORT_SEQPACKET ? BIND_SUFFIX : "");
 
     /* removes possible previous links */
     unlink(server_socket_name);
+    unlink(bind_name);
 
     /* gets socket size and initializes values */
-    addrlen = set_socket_address_unix(server_socket_name, &server_addr);
+    assert__(strlen(bind_name) < sizeof(server_addr.sun_path), "Error: server socket path is too long!\n")
+    addrlen = set_socket_address_unix(bind_name, &server_addr);
 
     /* assigns a local socket address to a socket identified by descriptor socket */
     assert__(bind(sock_fd, (struct sockaddr *) &server_addr, addrlen) != -1, "Error: couldn't bind server socket!\n")
 
+    if (transport == TRANSPORT_SEQPACKET) {
+        assert__(listen(sock_fd, SOMAXCONN) != -1, "Error: couldn't listen on server socket!\n")
+        assert__(rename(bind_name, server_socket_name) != -1, "Error: couldn't bind server socket!\n")
+
+        /* each connection takes a file descriptor, so the soft limit is raised as far as allowed */
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
     /* saves server socket file descriptor in a global variable so that other functions can access it */
     server_socket_fd = sock_fd;
 
+    /* a mirror of a previous server would give its clients stale lookups. a new one must exist
+     * before the root is committed, so the root is mirrored too */
+    char mirror_path[strlen(server_socket_name) + sizeof(TFS_NS_SUFFIX)];
+    sprintf(mirror_path, "%s%s", server_socket_name, TFS_NS_SUFFIX);
+    namespace_retire(mirror_path);
+    if (namespace_mirror)
+        assert__(namespace_open(mirror_path) == SUCCESS, "Error: couldn't create the namespace mirror!\n")
+
     /* init filesystem */
-    init_fs();
+    tecnicofs_init();
+
+    /* the staged engine's workers only execute; its other stages get threads of their own */
+    if (transport == TRANSPORT_DGRAM && engine == ENGINE_STAGED) {
+        pthread_t stage_thread;
 
-    /* creates all the requested threads. if it fails, reports an error */
-    for (int i = 0; i < numberThreads; i++)
+        for (int c = 0; c < CLASSES; c++)
+            assert__(mpmc_init(&execute_queues[c], class_limits[c]) == SUCCESS, "Error: couldn't create the stage queues!\n")
+        assert__(mpmc_init(&reply_queue, STAGE_QUEUE_SIZE) == SUCCESS && sem_init(&execute_ready, 0, 0) == 0,
+                 "Error: couldn't create the stage queues!\n")
+
+        for (int i = 0; i < receive_threads; i++)
+            assert__(pthread_create(&stage_thread, NULL, receiveRequests, NULL) == 0, "Error: couldn't create a thread!\n")
+        for (int i = 0; i < reply_threads; i++)
+            assert__(pthread_create(&stage_thread, NULL, sendReplies, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+
+    /* a single ring receives for the io_uring engine, so it is the only one woken per message */
+    if (transport == TRANSPORT_DGRAM && engine == ENGINE_URING && numberThreads > 1) {
+        pthread_t ring_thread;
+
+        assert__(mpmc_init(&uring_queue, URING_QUEUE_SIZE) == SUCCESS, "Error: couldn't create the io_uring queue!\n")
+        uring_dispatch = 1;
+        assert__(pthread_create(&ring_thread, NULL, receiveRequestsUring, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+
+    /* creates all the requested threads. if it fails, reports an error. a pool that changes size
+     * is left to its controller, which is what the main thread waits for then */
+    if (pool_max > 0) {
+        for (int i = 0; i < numberThreads; i++) start_worker();
+        assert__(pthread_create(&thread_ids[0], NULL, poolController, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+    else for (int i = 0; i < numberThreads; i++)
         assert__(pthread_create(&thread_ids[i], NULL, applyCommand_thread, NULL) == 0, "Error: couldn't create a thread!\n")
 
+    /* the main thread does the I/O of every connection */
+    if (transport == TRANSPORT_SEQPACKET) serveConnections();
+
     /* since our threads will never end, using pthread_join here will create an 'infinite loop' thus
      * keeping our server online without consuming much resources compared to using while(1) */
     pthread_join(thread_ids[0], NULL);
 
     /* since server never ends, this part will never be run. releases allocated memory */
-    destroy_fs();
+    tecnicofs_destroy();
 
     exit(EXIT_SUCCESS);
 
@@ -0,0 +1,174 @@
+#include "mpmc-queue.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+/*
+ * Sets up an empty queue.
+ *
+ * Input:
+ *   - queue: queue to set up
+ *   - size: maximum number of items (power of 2)
+ * Returns: SUCCESS or FAIL
+ * */
+int mpmc_init(mpmc_queue *queue, size_t size) {
+    if (size < 2 || (size & (size - 1)) != 0) return FAIL;
+
+    queue->cells = malloc(size * sizeof(mpmc_cell));
+    if (queue->cells == NULL) return FAIL;
+
+    for (size_t i = 0; i < size; i++) queue->cells[i].seq = i;
+    queue->mask = size - 1;
+    queue->enqueue_pos = queue->dequeue_pos = 0;
+    queue->pushes = queue->pops = 0;
+    queue->pop_waiters = queue->push_waiters = 0;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Frees a queue. Items still in it are not freed.
+ *
+ * Input:
+ *   - queue: queue set up by mpmc_init
+ * */
+void mpmc_destroy(mpmc_queue *queue) {
+    free(queue->cells);
+}
+
+
+/*
+ * Adds an item to a queue, without waiting.
+ *
+ * Input:
+ *   - queue: queue
+ *   - item: item to add (not NULL)
+ * Returns: SUCCESS or FAIL if the queue is full
+ * */
+int mpmc_try_push(mpmc_queue *queue, void *item) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+    while (1) {
+        mpmc_cell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            /* the cell is free; it is ours if no other producer took the position first */
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->item = item;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        else if (diff < 0) return FAIL;  /* the cell still holds an item from a lap ago */
+        else pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&queue->pushes, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->pop_waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &queue->pushes, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Takes the oldest item of a queue, without waiting.
+ *
+ * Input:
+ *   - queue: queue
+ * Returns: item or NULL if the queue is empty
+ * */
+void *mpmc_try_pop(mpmc_queue *queue) {
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    void *item;
+
+    while (1) {
+        mpmc_cell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                item = cell->item;
+                /* frees the cell for the producer of the next lap */
+                __atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+        else if (diff < 0) return NULL;  /* nothing was pushed at this position yet */
+        else pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&queue->pops, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->push_waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &queue->pops, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+    return item;
+}
+
+
+/*
+ * Sleeps until a futex word moves away from the value seen, unless it already did.
+ *
+ * Input:
+ *   - word: futex word
+ *   - seen: value read before finding there was nothing to do
+ *   - waiters: counter of the threads sleeping on word
+ * */
+static void mpmc_wait(uint32_t *word, uint32_t seen, uint32_t *waiters) {
+    /* a push or pop after the counter is raised either changes word first or sees the waiter */
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Adds an item to a queue, waiting while it is full.
+ *
+ * Input:
+ *   - queue: queue
+ *   - item: item to add (not NULL)
+ * */
+void mpmc_push(mpmc_queue *queue, void *item) {
+    while (1) {
+        uint32_t seen = __atomic_load_n(&queue->pops, __ATOMIC_SEQ_CST);
+        if (mpmc_try_push(queue, item) == SUCCESS) return;
+        mpmc_wait(&queue->pops, seen, &queue->push_waiters);
+    }
+}
+
+
+/*
+ * Takes the oldest item of a queue, waiting while it is empty.
+ *
+ * Input:
+ *   - queue: queue
+ * Returns: item
+ * */
+void *mpmc_pop(mpmc_queue *queue) {
+    while (1) {
+        uint32_t seen = __atomic_load_n(&queue->pushes, __ATOMIC_SEQ_CST);
+        void *item = mpmc_try_pop(queue);
+        if (item != NULL) return item;
+        mpmc_wait(&queue->pushes, seen, &queue->pop_waiters);
+    }
+}
+
+
+/*
+ * Input:
+ *   - queue: queue
+ * Returns: number of items in the queue. Only a hint while other threads use it
+ * */
+size_t mpmc_depth(mpmc_queue *queue) {
+    size_t dequeued = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    size_t enqueued = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fs/state.h"  /* SUCCESS and FAIL */
+
+/*
+ * Cell of a queue. seq tells whose turn it is: the producer of position p finds seq == p and
+ * the consumer of position p finds seq == p + 1
+ */
+typedef struct mpmc_cell {
+    size_t seq;
+    void *item;
+} mpmc_cell;
+
+/*
+ * Bounded queue of pointers for any number of producers and consumers (D. Vyukov's design).
+ * Producers and consumers only contend on their own position, with one compare-and-swap each,
+ * and never take a lock. Blocking calls sleep on a futex once the queue is full or empty
+ */
+typedef struct mpmc_queue {
+    mpmc_cell *cells;
+    size_t mask;  /* size - 1, size being a power of 2 */
+    char pad_enqueue[48];
+    size_t enqueue_pos;
+    char pad_dequeue[56];
+    size_t dequeue_pos;
+    char pad_wait[56];
+
+    /* futex words, bumped on every push and pop, and the number of threads sleeping on each */
+    uint32_t pushes, pops;
+    uint32_t pop_waiters, push_waiters;
+} mpmc_queue;
+
+int mpmc_init(mpmc_queue *queue, size_t size);
+void mpmc_destroy(mpmc_queue *queue);
+int mpmc_try_push(mpmc_queue *queue, void *item);
+void *mpmc_try_pop(mpmc_queue *queue);
+void mpmc_push(mpmc_queue *queue, void *item);
+void *mpmc_pop(mpmc_queue *queue);
+size_t mpmc_depth(mpmc_queue *queue);
+
+#endif /* MPMC_QUEUE_H */
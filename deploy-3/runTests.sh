@@ -1,19 +1,106 @@
 #!/bin/bash
+# Runs each input file with the client against the server in every transport and engine, and
+# in an embedded session, and checks what the client reports and the files it prints against
+# <input>_out.txt, the output of the classic engine. Run it from deploy-3 after make.
+# parallel*.txt inputs only look paths up: each is run by several clients at once, after the
+# commands of the matching .setup file, and every client must report the same as the classic
+# engine did with one.
+
+#server options of each run ("embedded" runs the file system inside the client). staged-busy
+#queues so few requests that parallel clients get busy replies and must send them again
+configs=("" "-e uring" "-e staged" "-e staged -q 2,2,2" "-e coroutine" "-t seqpacket" "-m" "-t seqpacket -m" "-n" "embedded")
+names=(classic uring staged staged-busy coroutine seqpacket shm seqpacket-shm mirror embedded)
+
+server=$PWD/tecnicofs
+client=$PWD/client/tecnicofs-client
+clients=4
+
+#starts the server in the current directory and waits for its socket. $1 is its options
+start_server() {
+	rm -f tfs.sock
+	$server $numthreads tfs.sock $1 > /dev/null 2>&1 &
+	serverpid=$!
+	for try in $(seq 1 50)
+	do
+		[ -S tfs.sock ] && return 0
+		sleep 0.1
+	done
+	return 1
+}
+
+stop_server() {
+	kill $serverpid 2>/dev/null
+	wait $serverpid 2>/dev/null
+}
+
+#prints the results the client reported, followed by each file it printed. messages of an
+#embedded file system and the mount line are left out
+collect_output() {
+	grep -E '^(Created|Unable|Search|Deleted|Moved|Printed|Entry|Streamed|Timeout)\b' $1
+	for printed in $(sed -n 's/^Printed .* to \(.*\)$/\1/p' $1)
+	do
+		echo "== $printed"
+		cat $printed
+	done
+}
+
+#runs an input file in the current directory. $1 is the input, $2 the server options
+run_input() {
+	#the client prints to paths relative to the current directory
+	sed -n 's/^[pi] \(.*\)\/[^/]*$/\1/p' $1 | xargs -r mkdir -p
+
+	if [ "$2" == "embedded" ]
+	then
+		timeout 60 $client $1 - > client.txt 2>&1
+	else
+		start_server "$2" || { echo "Server didn't start"; return; }
+		timeout 60 $client $1 tfs.sock > client.txt 2>&1
+		stop_server
+	fi
+	collect_output client.txt
+}
+
+#runs a parallel input in the current directory. $1 is the input, $2 the server options. the
+#output of the first client is printed, and any other that differs from it after its number
+run_parallel() {
+	start_server "$2" || { echo "Server didn't start"; return; }
+	if [ -f ${1%.*}.setup ]
+	then
+		timeout 60 $client ${1%.*}.setup tfs.sock > setup.txt 2>&1
+	fi
+	clientpids=()
+	for c in $(seq 1 $clients)
+	do
+		timeout 60 $client $1 tfs.sock > client$c.txt 2>&1 &
+		clientpids+=($!)
+	done
+	wait ${clientpids[@]}
+	stop_server
+
+	collect_output client1.txt > output1.txt
+	cat output1.txt
+	for c in $(seq 2 $clients)
+	do
+		collect_output client$c.txt > output$c.txt
+		cmp -s output1.txt output$c.txt || { echo "== client $c"; cat output$c.txt; }
+	done
+}
+
 #Checks if there are 3 arguments
 if [ $# -eq 3 ]
-then 
+then
 	#checks if the first argument is an existing directory
-	if [ -d "$1" ] 
+	if [ -d "$1" ]
 	then
-		inputdir=${1%/}
+		inputdir=$(cd $1 && pwd)
 	else
 		echo Input directory does not exist.
 		exit 1
 	fi
 	#checks if the second argument is an existing directory
-	if [ -d "$2" ] 
+	if [ -d "$2" ]
 	then
-		outputdir=${2%/}
+		outputdir=$(cd $2 && pwd)
 	else
 		echo Output directory does not exist.
 		exit 1
@@ -21,18 +108,40 @@ then
 	#checks if third argument is an integer and if it is greater than zero
 	if [ $3 -eq $3 2>/dev/null ] && [ $3 -gt 0 ]
 	then
-		maxthreads=$3
+		numthreads=$3
+		failed=0
 
-		for inputfile in ${inputdir}/*.txt
+		for i in ${!configs[@]}
 		do
-			filename=$(basename ${inputfile})
-			for numthreads in $(seq 1 $maxthreads)
+			for inputfile in ${inputdir}/*.txt
 			do
-				outputfile=${outputdir}/${filename%.*}-${numthreads}.txt
-				echo InputFile=$inputfile NumThreads=$numthreads
-				./tecnicofs $inputfile $outputfile $numthreads | grep "TecnicoFS completed"
+				filename=$(basename ${inputfile})
+				[[ $filename == *_out.txt ]] && continue
+				#clients of an embedded session don't share a file system
+				[[ $filename == parallel* && ${names[$i]} == embedded ]] && continue
+
+				#each run starts in an empty directory, with a server of its own
+				rundir=${outputdir}/${names[$i]}/${filename%.*}
+				rm -rf $rundir
+				mkdir -p $rundir
+				outputfile=${outputdir}/${names[$i]}/${filename%.*}.txt
+				if [[ $filename == parallel* ]]
+				then
+					(cd $rundir && run_parallel $inputfile "${configs[$i]}") > $outputfile
+				else
+					(cd $rundir && run_input $inputfile "${configs[$i]}") > $outputfile
+				fi
+
+				if diff -q ${inputfile%.*}_out.txt $outputfile > /dev/null 2>&1
+				then
+					echo InputFile=$inputfile Config=${names[$i]} OK
+				else
+					echo InputFile=$inputfile Config=${names[$i]} FAILED
+					failed=1
+				fi
 			done
 		done
+		exit $failed
 	else
 		echo "Incorrect number of threads. (3rd argument)"
 		exit 1
@@ -40,4 +149,4 @@ then
 else
 	echo "Wrong number of arguments. (3)"
 	exit 1
-fi
\ No newline at end of file
+fi
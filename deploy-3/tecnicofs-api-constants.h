@@ -5,6 +5,9 @@
 #define MAX_FILE_NAME 100
 #define MAX_INPUT_SIZE 100
 
+/* maximum size of a path, including the '\0'. each name in it is limited to MAX_FILE_NAME */
+#define MAX_PATH_SIZE 1024
+
 /* if condition is false displays msg and interrupts execution */
 #define assert__(cond, msg) if(! (cond)) { fprintf(stderr, msg); exit(EXIT_FAILURE); }
 
@@ -33,5 +36,9 @@ typedef enum type { T_FILE, T_DIRECTORY, T_NONE } type;
 #define TECNICOFS_ERROR_INVALID_MODE -10
 /* Generic error */
 #define TECNICOFS_ERROR_OTHER -11
+/* Server is too loaded to take the request; it can be retried later */
+#define TECNICOFS_ERROR_BUSY -12
+/* Deadline of the request passed before it could be done */
+#define TECNICOFS_ERROR_TIMEOUT -13
 
 #endif /* TECNICOFS_API_CONSTANTS_H */
@@ -0,0 +1,76 @@
+/* tecnicofs-namespace.h */
+#ifndef TECNICOFS_NAMESPACE_H
+#define TECNICOFS_NAMESPACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tecnicofs-api-constants.h"
+
+/*
+ * Namespace mirror: a server started with -n keeps a copy of every directory in a file next to
+ * its socket, at <socket>.ns. Clients map it read-only and resolve lookups on their own, like a
+ * vDSO. The server updates it as it commits each operation, inside a seqlock: seq is odd while
+ * an update is being written, so a reader that sees the same even seq before and after walking
+ * a path knows nothing changed meanwhile. Readers that keep losing the race ask the server.
+ */
+
+/* layout version of the region, checked by clients when mapping it */
+#define TFS_NS_VERSION 1
+
+/* suffix added to the server socket path to get the path of the mirror */
+#define TFS_NS_SUFFIX ".ns"
+
+/* times a client walks a path while the server updates the mirror before asking the server */
+#define TFS_NS_RETRIES 4
+
+/*
+ * Entry of a mirrored directory. Free entries have inumber -1
+ */
+typedef struct tfs_ns_entry {
+    char name[MAX_FILE_NAME];
+    int32_t inumber;
+} tfs_ns_entry;
+
+/*
+ * Mirrored i-node. Entries are only meaningful for directories
+ */
+typedef struct tfs_ns_inode {
+    int32_t node_type;  /* T_FILE, T_DIRECTORY or T_NONE if the i-node is free */
+    tfs_ns_entry entries[];
+} tfs_ns_inode;
+
+/*
+ * Header of the region, followed by the i-nodes
+ */
+typedef struct tfs_ns_region {
+    uint32_t version;
+    uint32_t seq;  /* odd while the server writes */
+    uint32_t closed;  /* set when a newer server replaces the mirror */
+    int32_t inodes;  /* number of i-nodes */
+    int32_t entries;  /* number of entries of each directory */
+    char pad[44];
+} tfs_ns_region;
+
+
+/*
+ * Input:
+ *   - inodes, entries: sizes of the mirrored table
+ * Returns: size of a region
+ * */
+static inline size_t tfs_ns_size(int inodes, int entries) {
+    return sizeof(tfs_ns_region) + (size_t) inodes * (sizeof(tfs_ns_inode) + entries * sizeof(tfs_ns_entry));
+}
+
+
+/*
+ * Input:
+ *   - region: mirror
+ *   - inumber: i-node, between 0 and region->inodes
+ * Returns: the mirrored i-node
+ * */
+static inline tfs_ns_inode *tfs_ns_inode_at(tfs_ns_region *region, int inumber) {
+    char *inodes = (char *) region + sizeof(tfs_ns_region);
+    return (tfs_ns_inode *) (inodes + (size_t) inumber * (sizeof(tfs_ns_inode) + region->entries * sizeof(tfs_ns_entry)));
+}
+
+#endif /* TECNICOFS_NAMESPACE_H */
@@ -0,0 +1,123 @@
+/* tecnicofs-protocol.h */
+#ifndef TECNICOFS_PROTOCOL_H
+#define TECNICOFS_PROTOCOL_H
+
+#include <stdint.h>
+#include <time.h>
+#include "tecnicofs-api-constants.h"
+
+/* version written in every message. messages with another version are rejected */
+#define TFS_PROTOCOL_VERSION 3
+
+/* maximum size of a message, in either direction */
+#define TFS_MAX_MESSAGE 65536
+
+/* maximum number of operations in a batch */
+#define TFS_MAX_BATCH 256
+
+/* maximum number of asynchronous requests a client keeps in flight */
+#define TFS_MAX_IN_FLIGHT 64
+
+/* requests inside a batch start at multiples of 8 bytes, so their headers stay aligned */
+#define TFS_ALIGN(size) (((size) + 7) & ~7)
+
+/* maximum number of tree dump bytes sent in each message of a streamed print */
+#define STREAM_CHUNK_SIZE 4096
+
+/* request opcodes. they match the commands of the input files */
+#define OP_CREATE 'c'
+#define OP_DELETE 'd'
+#define OP_LOOKUP 'l'
+#define OP_MOVE 'm'
+#define OP_PRINT 'p'
+#define OP_PRINT_CHANGES 'i'
+#define OP_STREAM 's'
+#define OP_BATCH 'b'
+#define OP_SHM_ATTACH 'a'  /* moves the session to the shared memory region passed with it */
+#define OP_STATS 'q'  /* reports the threads and queue depths of the server */
+
+/* request flags */
+#define TFS_FLAG_DIRECTORY 0x1  /* creates a directory instead of a file */
+
+/* response flags */
+#define TFS_FLAG_MORE 0x1  /* more messages of the same stream follow */
+
+/*
+ * Header of every request. It is followed by the paths, back to back, each one ending in '\0'
+ * and counted in path_size. Unused paths have size 0.
+ * A batch (OP_BATCH) has no paths and arg holds the number of operations. Their requests
+ * follow the header, each starting at a TFS_ALIGN boundary
+ */
+typedef struct tfs_request_header {
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t flags;
+    uint32_t request_id;
+    int64_t arg;  /* sequence number for OP_PRINT_CHANGES */
+    uint16_t path_size[2];
+    uint32_t deadline;  /* tfs_clock_ms time after which the client stops waiting (0 for none) */
+} tfs_request_header;
+
+/*
+ * Header of every response. It is followed by size bytes of payload: a piece of the tree in
+ * stream messages, the int32_t status of each operation in batches, the int64_t sequence number
+ * of a successful OP_PRINT_CHANGES and nothing otherwise
+ */
+typedef struct tfs_response_header {
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t flags;
+    uint32_t request_id;
+    int32_t status;  /* result of the operation or one of the TECNICOFS_ERROR_* codes */
+    uint32_t size;
+} tfs_response_header;
+
+/*
+ * Payload of the response to OP_STATS. Stages an engine doesn't have report no threads
+ */
+typedef struct tfs_stats {
+    int32_t receivers;  /* threads reading requests from the socket */
+    int32_t workers;  /* threads executing requests */
+    int32_t senders;  /* threads sending replies */
+    int32_t execute_depth, execute_capacity;  /* requests waiting for a worker */
+    int32_t reply_depth, reply_capacity;  /* replies waiting for a sender */
+    int32_t rejected;  /* requests turned away busy since the start */
+    int32_t expired;  /* requests dropped since the start because their deadline passed */
+    int32_t coalesced;  /* lookups answered since the start with the result of an identical one */
+    int32_t direct;  /* responses sent since the start by the thread that executed the request,
+                      * skipping the reply stage: stream messages and shared memory sessions */
+} tfs_stats;
+
+
+/*
+ * Returns: CLOCK_MONOTONIC time in milliseconds, cut to 32 bits. Clients and the server share
+ * the clock, since they run on the same machine, so deadlines need no translation
+ * */
+static inline uint32_t tfs_clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+
+/*
+ * Input:
+ *   - timeout_ms: time the client waits for the response
+ * Returns: deadline of a request sent now. 0 means no deadline, so it is never returned
+ * */
+static inline uint32_t tfs_deadline(int timeout_ms) {
+    uint32_t deadline = tfs_clock_ms() + (uint32_t) timeout_ms;
+    return deadline != 0 ? deadline : 1;
+}
+
+
+/*
+ * Input:
+ *   - deadline: deadline of a request (not 0)
+ * Returns: milliseconds left until the deadline, negative once it has passed
+ * */
+static inline int32_t tfs_time_left(uint32_t deadline) {
+    return (int32_t) (deadline - tfs_clock_ms());
+}
+
+#endif /* TECNICOFS_PROTOCOL_H */
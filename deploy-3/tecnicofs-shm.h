@@ -0,0 +1,209 @@
+/* tecnicofs-shm.h */
+#ifndef TECNICOFS_SHM_H
+#define TECNICOFS_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "tecnicofs-protocol.h"
+
+/*
+ * Shared memory sessions: the client creates a region with a request ring and a response
+ * ring, passes it to the server with OP_SHM_ATTACH and from then on both sides exchange the
+ * same messages as on the socket through the rings, each one with a single producer and a
+ * single consumer. A side with nothing to do spins a while and then sleeps on a futex doorbell
+ * that the other side rings whenever it produces or consumes a message.
+ */
+
+/* layout version of the region, checked by the server when attaching */
+#define TFS_SHM_VERSION 1
+
+/* bytes of each ring (power of 2, holds a few of the largest messages) */
+#define TFS_SHM_RING_SIZE (1 << 18)
+
+/* records start at multiples of 8 bytes, so message headers stay aligned */
+#define TFS_SHM_RECORD(size) ((8 + (size) + 7) & ~7u)
+
+/* size of the record that tells the reader to skip to the start of the ring */
+#define TFS_SHM_WRAP 0xFFFFFFFFu
+
+/* bounds of the adaptive spinning done before sleeping, in rounds */
+#define TFS_SHM_SPIN_MIN 16
+#define TFS_SHM_SPIN_MAX 16384
+
+/* time slept at most before checking if the other side is still alive, in milliseconds */
+#define TFS_SHM_LIVENESS_MS 500
+
+/*
+ * Futex doorbell. seq grows every time the other side makes progress
+ */
+typedef struct tfs_shm_bell {
+    uint32_t seq;
+    uint32_t sleeping;  /* 1 while the owner sleeps on seq */
+    char pad[56];  /* keeps the two sides' doorbells in different cache lines */
+} tfs_shm_bell;
+
+/*
+ * Ring of variable sized records. Positions grow forever and wrap around the data
+ */
+typedef struct tfs_shm_ring {
+    uint32_t head;  /* written by the consumer */
+    char pad_head[60];
+    uint32_t tail;  /* written by the producer */
+    char pad_tail[60];
+    char data[TFS_SHM_RING_SIZE];
+} tfs_shm_ring;
+
+/*
+ * Region shared by a client and the server
+ */
+typedef struct tfs_shm_region {
+    uint32_t version;
+    int32_t client_pid;  /* informative only. the server gets the client's process from the kernel */
+    int32_t server_pid;  /* set by the server when attaching */
+    uint32_t closed;  /* set by the client when it is done */
+    char pad[48];
+    tfs_shm_bell server_bell;  /* rung by the client */
+    tfs_shm_bell client_bell;  /* rung by the server */
+    tfs_shm_ring requests;
+    tfs_shm_ring responses;
+} tfs_shm_region;
+
+
+/*
+ * Gets room for a message at the end of a ring. Must be followed by tfs_shm_commit.
+ *
+ * Input:
+ *   - ring: ring written by the caller
+ *   - size: size of the message
+ * Returns: where the message is written or NULL if the ring is too full for now
+ * */
+static inline char *tfs_shm_reserve(tfs_shm_ring *ring, uint32_t size) {
+    uint32_t need = TFS_SHM_RECORD(size);
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t offset = tail & (TFS_SHM_RING_SIZE - 1);
+    uint32_t skip = offset + need > TFS_SHM_RING_SIZE ? TFS_SHM_RING_SIZE - offset : 0;
+
+    if (TFS_SHM_RING_SIZE - (tail - head) < skip + need) return NULL;
+
+    /* records don't wrap: the reader is told to skip what is left until the end */
+    if (skip > 0) {
+        *(uint32_t *) (ring->data + offset) = TFS_SHM_WRAP;
+        __atomic_store_n(&ring->tail, tail + skip, __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    *(uint32_t *) (ring->data + offset) = size;
+    return ring->data + offset + 8;
+}
+
+
+/*
+ * Publishes the message written at the room given by tfs_shm_reserve.
+ *
+ * Input:
+ *   - ring: ring written by the caller
+ *   - size: size of the message
+ * */
+static inline void tfs_shm_commit(tfs_shm_ring *ring, uint32_t size) {
+    __atomic_store_n(&ring->tail, ring->tail + TFS_SHM_RECORD(size), __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Gets the oldest message of a ring, leaving it there. Must be followed by tfs_shm_release.
+ *
+ * Input:
+ *   - ring: ring read by the caller
+ *   - size: gets the size of the message
+ * Returns: the message or NULL if the ring is empty
+ * */
+static inline char *tfs_shm_peek(tfs_shm_ring *ring, uint32_t *size) {
+    uint32_t head = ring->head;
+
+    while (1) {
+        if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return NULL;
+
+        uint32_t offset = head & (TFS_SHM_RING_SIZE - 1);
+        *size = *(uint32_t *) (ring->data + offset);
+        if (*size != TFS_SHM_WRAP) return ring->data + offset + 8;
+
+        head += TFS_SHM_RING_SIZE - offset;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+ * Frees the room of the message returned by tfs_shm_peek.
+ *
+ * Input:
+ *   - ring: ring read by the caller
+ *   - size: size of the message
+ * */
+static inline void tfs_shm_release(tfs_shm_ring *ring, uint32_t size) {
+    __atomic_store_n(&ring->head, ring->head + TFS_SHM_RECORD(size), __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Returns: initial spinning rounds for tfs_shm_wait. With a single CPU the other side can't run
+ *          while this one spins, so it goes straight to sleep
+ * */
+static inline int tfs_shm_spin_start() {
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TFS_SHM_SPIN_MIN : 0;
+}
+
+
+/*
+ * Rings a doorbell, waking its owner if it sleeps.
+ *
+ * Input:
+ *   - bell: doorbell of the other side
+ * */
+static inline void tfs_shm_ring_bell(tfs_shm_bell *bell) {
+    __atomic_add_fetch(&bell->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bell->sleeping, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &bell->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+
+/*
+ * Waits until a doorbell is rung after seq was read as seen. Spins first, for as many rounds
+ * as last time it paid off, and then sleeps. The rounds double when the bell rings while
+ * spinning and halve when it doesn't, so spinning stops wasting time on idle sessions.
+ *
+ * Input:
+ *   - bell: doorbell of the caller
+ *   - seen: value of seq read before checking there was nothing to do
+ *   - spin: spinning rounds, adapted on each call
+ * Returns: 1 if the bell rang, 0 if TFS_SHM_LIVENESS_MS passed without it
+ * */
+static inline int tfs_shm_wait(tfs_shm_bell *bell, uint32_t seen, int *spin) {
+
+    for (int i = 0; i < *spin; i++) {
+        if (__atomic_load_n(&bell->seq, __ATOMIC_ACQUIRE) != seen) {
+            if (*spin < TFS_SHM_SPIN_MAX) *spin *= 2;
+            return 1;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    if (*spin > TFS_SHM_SPIN_MIN) *spin /= 2;
+
+    /* a ring between setting sleeping and the futex call changes seq, so the futex returns */
+    struct timespec timeout = { 0, TFS_SHM_LIVENESS_MS * 1000000L };
+    __atomic_store_n(&bell->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, &bell->seq, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    __atomic_store_n(&bell->sleeping, 0, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&bell->seq, __ATOMIC_ACQUIRE) != seen;
+}
+
+#endif /* TECNICOFS_SHM_H */
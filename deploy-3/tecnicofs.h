@@ -0,0 +1,44 @@
+/* tecnicofs.h */
+#ifndef TECNICOFS_H
+#define TECNICOFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "tecnicofs-api-constants.h"
+
+/*
+ * TecnicoFS engine, linked into the process as libtecnicofs. The socket server is one user of
+ * it; any other program can use it directly and skip the server altogether. There is one file
+ * system per process, set up by tecnicofs_init, and every call can be made from any number of
+ * threads at the same time.
+ */
+
+/* pages the file system's memory is mapped with, for tecnicofs_set_pages */
+#define TECNICOFS_PAGES_NORMAL 0
+#define TECNICOFS_PAGES_THP 1  /* transparent huge pages */
+#define TECNICOFS_PAGES_HUGETLB 2  /* huge pages reserved in /proc/sys/vm/nr_hugepages */
+
+/* consumes a piece of a dump, in order. returns 0 to go on, anything else to stop the dump */
+typedef int (*tecnicofs_dump_fn)(void *arg, const char *bytes, size_t size);
+
+/* runs while a lock needed by the calling thread is busy, e.g. to switch to another task */
+typedef void (*tecnicofs_wait_fn)(void);
+
+int tecnicofs_set_pages(int pages);
+int tecnicofs_pages();
+int tecnicofs_init();
+void tecnicofs_destroy();
+int tecnicofs_create(char *path, type node_type);
+int tecnicofs_delete(char *path);
+int tecnicofs_lookup(char *path);
+int tecnicofs_move(char *from, char *to);
+int tecnicofs_print(char *out_file);
+int tecnicofs_print_changes(char *out_file, int64_t since, int64_t *seq);
+int tecnicofs_dump(tecnicofs_dump_fn fn, void *arg);
+void tecnicofs_set_lock_wait(tecnicofs_wait_fn wait);
+long tecnicofs_lock_wait_time();
+long tecnicofs_coalesced_lookups();
+void tecnicofs_set_deadline(const struct timespec *deadline);
+
+#endif /* TECNICOFS_H */